@@ -1,5 +1,6 @@
 #include <android-base/logging.h>
 #include <hidl-util/FQName.h>
+#include <hwbinder/IPCThreadState.h>
 #include <log/log.h>
 
 #include "AccessControl.h"
@@ -18,6 +19,13 @@ struct audit_data {
 
 using android::FQName;
 
+// Upper bound on cached decisions and check names. Reaching it drops the
+// whole cache; hwservicemanager normally sees far fewer (sid, fqName) pairs.
+static constexpr size_t kMaxCacheEntries = 4096;
+
+// Entries matchesSelabel() looks up per hold of mSelinuxLock.
+static constexpr size_t kSelabelCheckChunk = 32;
+
 AccessControl::AccessControl() {
 #ifndef SE_HACK
     mSeHandle = selinux_android_hw_service_context_handle();
@@ -37,30 +45,150 @@ AccessControl::AccessControl() {
     selinux_set_callback(SELINUX_CB_LOG, mSeCallbacks);
 }
 
-bool AccessControl::canAdd(const std::string& fqName, const CallingContext& callingContext) {
-    FQName fqIface(fqName);
+bool AccessControl::canAdd(std::string_view fqName, const CallingContext& callingContext) {
+    return canAccessInterface(fqName, callingContext, kAllowedAdd, kPermissionAdd);
+}
+
+bool AccessControl::canGet(std::string_view fqName, const CallingContext& callingContext) {
+    return canAccessInterface(fqName, callingContext, kAllowedGet, kPermissionGet);
+}
 
-    if (!fqIface.isValid()) {
+bool AccessControl::canList(const CallingContext& callingContext) {
+    if (!callingContext.sidPresent) {
         return false;
     }
-    const std::string checkName = fqIface.package() + "::" + fqIface.name();
 
-    return checkPermission(callingContext, kPermissionAdd, checkName.c_str());
+    uint64_t generation = getPolicyGeneration();
+    {
+        std::shared_lock<std::shared_mutex> lock(mCacheLock);
+        const CallerDecisions *decisions = findDecisions(callingContext);
+        if (mCacheGeneration == generation && decisions != nullptr && decisions->canList) {
+            return true;
+        }
+    }
+
+    if (!checkPermission(callingContext, mSeContext, kPermissionList, nullptr)) {
+        return false;
+    }
+
+    cacheAllowed(callingContext, generation, std::string_view(), 0);
+    return true;
 }
 
-bool AccessControl::canGet(const std::string& fqName, const CallingContext& callingContext) {
-    FQName fqIface(fqName);
+bool AccessControl::canAccessInterface(std::string_view fqName,
+                                       const CallingContext& callingContext,
+                                       uint8_t allowedBit, const char *perm) {
+    if (!callingContext.sidPresent) {
+        return false;
+    }
+
+    uint64_t generation = getPolicyGeneration();
+    {
+        std::shared_lock<std::shared_mutex> lock(mCacheLock);
+        const CallerDecisions *decisions = findDecisions(callingContext);
+        if (mCacheGeneration == generation && decisions != nullptr) {
+            const uint8_t *allowed = decisions->interfaces.find(fqName);
+            if (allowed != nullptr && (*allowed & allowedBit)) {
+                return true;
+            }
+        }
+    }
+
+    const std::string checkName = getCheckName(fqName);
+    if (checkName.empty()) {
+        return false;
+    }
 
-    if (!fqIface.isValid()) {
+    if (!checkPermission(callingContext, perm, checkName.c_str())) {
         return false;
     }
-    const std::string checkName = fqIface.package() + "::" + fqIface.name();
 
-    return checkPermission(callingContext, kPermissionGet, checkName.c_str());
+    cacheAllowed(callingContext, generation, fqName, allowedBit);
+    return true;
 }
 
-bool AccessControl::canList(const CallingContext& callingContext) {
-    return checkPermission(callingContext, mSeContext, kPermissionList, nullptr);
+std::string AccessControl::getCheckName(std::string_view fqName) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mCacheLock);
+        const std::string *checkName = mCheckNames.find(fqName);
+        if (checkName != nullptr) {
+            return *checkName;
+        }
+    }
+
+    FQName fqIface{std::string(fqName)};
+    std::string checkName;
+    if (fqIface.isValid()) {
+        checkName = fqIface.package() + "::" + fqIface.name();
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mCacheLock);
+    if (mCheckNames.size() >= kMaxCacheEntries) {
+        mCheckNames = {};
+    }
+    mCheckNames[fqName] = checkName;
+    return checkName;
+}
+
+uint64_t AccessControl::getPolicyGeneration() {
+    // Both read the status page mapped by selinux_status_open(), without a syscall.
+    uint32_t seqno = static_cast<uint32_t>(selinux_status_policyload());
+    uint32_t enforcing = static_cast<uint32_t>(selinux_status_getenforce());
+    return (static_cast<uint64_t>(seqno) << 32) | enforcing;
+}
+
+AccessControl::CallerDecisions *AccessControl::findDecisions(const CallingContext& callingContext) {
+    return mDecisions.find(std::string_view(callingContext.sid));
+}
+
+void AccessControl::cacheAllowed(const CallingContext& callingContext, uint64_t generation,
+                                 std::string_view fqName, uint8_t allowedBit) {
+    std::unique_lock<std::shared_mutex> lock(mCacheLock);
+
+    if (mCacheGeneration != generation) {
+        if (getPolicyGeneration() != generation) {
+            // The policy changed while this decision was made.
+            return;
+        }
+        mDecisions = {};
+        mCachedDecisions = 0;
+        mCacheGeneration = generation;
+    }
+
+    if (mCachedDecisions >= kMaxCacheEntries) {
+        mDecisions = {};
+        mCachedDecisions = 0;
+    }
+
+    CallerDecisions &decisions = mDecisions[std::string_view(callingContext.sid)];
+    if (fqName.empty()) {
+        decisions.canList = true;
+        return;
+    }
+
+    auto inserted = decisions.interfaces.insert(std::string(fqName), allowedBit);
+    if (inserted.second) {
+        mCachedDecisions++;
+    } else {
+        *inserted.first |= allowedBit;
+    }
+}
+
+AccessControl::CallingContext AccessControl::getCallingContext() {
+    const auto& self = ::android::hardware::IPCThreadState::self();
+
+    pid_t pid = self->getCallingPid();
+    const char* sid = self->getCallingSid();
+
+    if (sid == nullptr) {
+        if (pid != getpid()) {
+            android_errorWriteLog(0x534e4554, "121035042");
+        }
+
+        return getCallingContext(pid);
+    } else {
+        return { true, sid, pid };
+    }
 }
 
 AccessControl::CallingContext AccessControl::getCallingContext(pid_t sourcePid) {
@@ -89,21 +217,94 @@ bool AccessControl::checkPermission(const CallingContext& source, const char *ta
     ad.sid = source.sid.c_str();
     ad.interfaceName = interface;
 
+    std::lock_guard<std::mutex> lock(mSelinuxLock);
     allowed = (selinux_check_access(source.sid.c_str(), targetContext, "hwservice_manager",
                                     perm, (void *) &ad) == 0);
 
     return allowed;
 }
 
+std::shared_ptr<const LabelTable> AccessControl::getLabels() {
+    int policyload = selinux_status_policyload();
+    if (policyload != mLabelsPolicyload.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(mLabelsLoadLock);
+        if (policyload != mLabelsPolicyload.load(std::memory_order_relaxed)) {
+            loadLabels(policyload);
+        }
+    }
+    return std::atomic_load(&mLabels);
+}
+
+void AccessControl::preloadLabels() {
+    getLabels();
+}
+
+void AccessControl::loadLabels(int policyload) {
+    auto labels = std::make_shared<LabelTable>();
+    if (!labels->load(LabelTable::defaultPaths()) || labels->empty()) {
+        ALOGW("Could not read hwservice_contexts, falling back to selabel_lookup().");
+        labels = nullptr;
+    } else if (!matchesSelabel(*labels)) {
+        // e.x. libselinux reads a file LabelTable::defaultPaths() doesn't list.
+        ALOGW("hwservice_contexts files differ from libselinux's, falling back to selabel_lookup().");
+        labels = nullptr;
+    }
+
+    std::atomic_store(&mLabels, std::shared_ptr<const LabelTable>(std::move(labels)));
+    mLabelsPolicyload.store(policyload, std::memory_order_release);
+}
+
+bool AccessControl::matchesSelabel(const LabelTable& labels) {
+    if (mSeHandle == nullptr) {
+        return true; // nothing to compare with
+    }
+
+    // Access checks share mSelinuxLock, so it is dropped between chunks
+    // rather than held for the whole table.
+    bool matches = true;
+    size_t checked = 0;
+    std::unique_lock<std::mutex> lock(mSelinuxLock, std::defer_lock);
+    labels.forEach([&](const std::string& name, const std::string& context) {
+        if (!matches) {
+            return;
+        }
+        if (!lock.owns_lock()) {
+            lock.lock();
+        }
+        char *targetContext = nullptr;
+        if (selabel_lookup(mSeHandle, &targetContext, name.c_str(), 0) != 0) {
+            matches = false;
+            return;
+        }
+        matches = context == targetContext;
+        freecon(targetContext);
+        if (++checked % kSelabelCheckChunk == 0) {
+            lock.unlock();
+        }
+    });
+    return matches;
+}
+
 bool AccessControl::checkPermission(const CallingContext& source, const char *perm, const char *interface) {
     se_hack1(true);
+
+    std::shared_ptr<const LabelTable> labels = getLabels();
+    const std::string *labeled = labels != nullptr ? labels->lookup(interface) : nullptr;
+    if (labeled != nullptr) {
+        return checkPermission(source, labeled->c_str(), perm, interface);
+    }
+
     char *targetContext = nullptr;
     bool allowed = false;
 
-    // Lookup service in hwservice_contexts
-    if (selabel_lookup(mSeHandle, &targetContext, interface, 0) != 0) {
-        ALOGE("No match for interface %s in hwservice_contexts", interface);
-        return false;
+    // Lookup service in hwservice_contexts. Names without an entry of their
+    // own get the "*" default here, from every file libselinux read.
+    {
+        std::lock_guard<std::mutex> lock(mSelinuxLock);
+        if (selabel_lookup(mSeHandle, &targetContext, interface, 0) != 0) {
+            ALOGE("No match for interface %s in hwservice_contexts", interface);
+            return false;
+        }
     }
 
     allowed = checkPermission(source, targetContext, perm, interface);
@@ -1,34 +1,106 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 
 #include <selinux/android.h>
 #include <selinux/avc.h>
 
+#include "AccessControlBackend.h"
+#include "FlatHashMap.h"
+#include "LabelTable.h"
+
 namespace android {
 
-class AccessControl {
+class AccessControl : public AccessControlBackend {
 public:
     AccessControl();
 
-    struct CallingContext {
-        bool sidPresent;
-        std::string sid;
-        pid_t pid;
-    };
+    // Uses the sid binder sent with the call, or looks it up by pid.
+    CallingContext getCallingContext() override;
     static CallingContext getCallingContext(pid_t sourcePid);
 
-    bool canAdd(const std::string& fqName, const CallingContext& callingContext);
-    bool canGet(const std::string& fqName, const CallingContext& callingContext);
-    bool canList(const CallingContext& callingContext);
+    bool canAdd(std::string_view fqName, const CallingContext& callingContext) override;
+    bool canGet(std::string_view fqName, const CallingContext& callingContext) override;
+    bool canList(const CallingContext& callingContext) override;
+
+    /**
+     * Builds the hwservice_contexts table ahead of the first access check,
+     * which otherwise builds it. Safe to call from any thread, concurrently
+     * with the checks.
+     */
+    void preloadLabels();
 
 private:
+    template <typename Key, typename Value>
+    using StringMap = ::android::hidl::manager::implementation::FlatHashMap<
+        Key, Value, ::android::hidl::manager::implementation::StringViewHash>;
+
+    // bits in CallerDecisions
+    static constexpr uint8_t kAllowedAdd = 1 << 0;
+    static constexpr uint8_t kAllowedGet = 1 << 1;
+
+    /**
+     * Allowed decisions for one calling sid. Denials are never cached, so
+     * every denial is still checked and audited by libselinux.
+     */
+    struct CallerDecisions {
+        bool canList = false;
+        StringMap<std::string, uint8_t> interfaces{}; // fqName -> kAllowed* bits
+    };
+
+    bool canAccessInterface(std::string_view fqName, const CallingContext& callingContext,
+                            uint8_t allowedBit, const char *perm);
+
+    // "package::name" to check for fqName, or "" if fqName isn't valid
+    std::string getCheckName(std::string_view fqName);
+
+    // Changes whenever the policy is reloaded or the enforcing mode toggles.
+    static uint64_t getPolicyGeneration();
+
+    // Returns the decisions for callingContext's sid; requires mCacheLock.
+    CallerDecisions *findDecisions(const CallingContext& callingContext);
+    // Records an allowed decision made under generation; takes mCacheLock.
+    // An empty fqName records the list permission.
+    void cacheAllowed(const CallingContext& callingContext, uint64_t generation,
+                      std::string_view fqName, uint8_t allowedBit);
+
+    /**
+     * Returns the hwservice_contexts table, reloading it first if the
+     * policy was reloaded since it was built. nullptr if no
+     * hwservice_contexts file could be read.
+     */
+    std::shared_ptr<const LabelTable> getLabels();
+    void loadLabels(int policyload);
+    // Whether every entry of labels is what selabel_lookup() returns for it.
+    // Takes mSelinuxLock for a chunk of entries at a time.
+    bool matchesSelabel(const LabelTable& labels);
 
     bool checkPermission(const CallingContext& source, const char *targetContext, const char *perm, const char *interface);
     bool checkPermission(const CallingContext& source, const char *perm, const char *interface);
 
     static int auditCallback(void *data, security_class_t cls, char *buf, size_t len);
 
+    // libselinux's AVC and label lookups aren't thread-safe.
+    std::mutex             mSelinuxLock;
+
+    // mLabelsPolicyload before the first loadLabels(); not a valid policyload.
+    static constexpr int   kLabelsNotLoaded = -2;
+
+    std::mutex             mLabelsLoadLock;
+    std::atomic<int>       mLabelsPolicyload{kLabelsNotLoaded};
+    std::shared_ptr<const LabelTable> mLabels; // accessed with std::atomic_load/store
+
+    std::shared_mutex      mCacheLock; // guards the members below
+    uint64_t               mCacheGeneration = 0;
+    size_t                 mCachedDecisions = 0;
+    StringMap<std::string, CallerDecisions> mDecisions{}; // sid -> decisions
+    StringMap<std::string, std::string>     mCheckNames{}; // fqName -> getCheckName(fqName)
+
     char*                  mSeContext;
-    struct selabel_handle* mSeHandle;
+    struct selabel_handle* mSeHandle = nullptr;
     union selinux_callback mSeCallbacks;
 };
 
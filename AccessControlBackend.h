@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+
+namespace android {
+
+/**
+ * Decides who may add, get and list which interfaces in hwservicemanager.
+ *
+ * AccessControl implements it with SELinux and binder caller identities.
+ * Host-side tools and benchmarks inject their own, so the manager can run
+ * without a binder driver or a loaded policy.
+ *
+ * All methods may be called from several threads at once.
+ */
+class AccessControlBackend {
+public:
+    struct CallingContext {
+        bool sidPresent;
+        std::string sid;
+        pid_t pid;
+    };
+
+    virtual ~AccessControlBackend() = default;
+
+    // Identifies the process behind the call currently being served.
+    virtual CallingContext getCallingContext() = 0;
+
+    virtual bool canAdd(std::string_view fqName, const CallingContext& callingContext) = 0;
+    virtual bool canGet(std::string_view fqName, const CallingContext& callingContext) = 0;
+    virtual bool canList(const CallingContext& callingContext) = 0;
+};
+
+} // namespace android
@@ -0,0 +1,39 @@
+#ifndef ANDROID_HARDWARE_MANAGER_BINDERIDENTITY_H
+#define ANDROID_HARDWARE_MANAGER_BINDERIDENTITY_H
+
+#include <android/hidl/base/1.0/IBase.h>
+#include <hidl/HidlBinderSupport.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::base::V1_0::IBase;
+using ::android::sp;
+
+/**
+ * What identifies an interface object, by the same rule interfacesEqual()
+ * uses: the binder a remote object wraps (every call hands out a new proxy
+ * for it), or the object itself when it lives in this process.
+ *
+ * The key stays valid only while the caller holds object. A local stub only
+ * caches its binder weakly, so that binder can't be used as the key.
+ */
+inline const void *identityOf(const sp<IBase> &object) {
+    if (object == nullptr) {
+        return nullptr;
+    }
+    if (object->isRemote()) {
+        // The proxy holds its binder strongly.
+        return ::android::hardware::toBinder<IBase>(object).get();
+    }
+    return object.get();
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_BINDERIDENTITY_H
@@ -0,0 +1,256 @@
+#define LOG_TAG "hwservicemanager"
+
+#include "CallRecorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <android-base/file.h>
+#include <log/log.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+// Buffered records are written out once they reach this size.
+static constexpr size_t kFlushBytes = 16 * 1024;
+
+constexpr char CallRecorder::kMagic[8];
+
+std::shared_ptr<CallRecorder> CallRecorder::open(const std::string &path,
+                                                 CallerResolver callerOf) {
+    ::android::base::unique_fd fd(TEMP_FAILURE_RETRY(
+            ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600)));
+    if (fd < 0) {
+        ALOGE("Failed to open call trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    if (!::android::base::WriteFully(fd, kMagic, sizeof(kMagic))) {
+        ALOGE("Failed to write call trace %s: %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+    return std::shared_ptr<CallRecorder>(new CallRecorder(std::move(fd), std::move(callerOf)));
+}
+
+CallRecorder::CallRecorder(::android::base::unique_fd fd, CallerResolver callerOf)
+    : mCallerOf(std::move(callerOf)),
+      mStart(std::chrono::steady_clock::now()),
+      mFd(std::move(fd)) {
+    mBuffer.reserve(kFlushBytes * 2);
+}
+
+CallRecorder::~CallRecorder() {
+    flush();
+}
+
+CallRecorder::Call::Call(CallRecorder *recorder, Method method,
+                         std::string_view fqName, std::string_view instance)
+    : mRecorder(recorder), mMethod(method) {
+    if (mRecorder == nullptr) {
+        return;
+    }
+    mFqName = fqName;
+    mInstance = instance;
+    mCaller = mRecorder->mCallerOf ? mRecorder->mCallerOf()
+                                   : AccessControlBackend::CallingContext{false, "", 0};
+    mStart = std::chrono::steady_clock::now();
+}
+
+CallRecorder::Call::~Call() {
+    if (mRecorder == nullptr) {
+        return;
+    }
+    using std::chrono::duration_cast;
+    const auto end = std::chrono::steady_clock::now();
+
+    mRecorder->write({
+        mMethod, mFlags, mResult, mCaller.pid, mCaller.sid, mFqName, mInstance, mBinder, mArg,
+        static_cast<uint64_t>(
+                duration_cast<std::chrono::microseconds>(mStart - mRecorder->mStart).count()),
+        static_cast<uint64_t>(duration_cast<std::chrono::nanoseconds>(end - mStart).count()),
+    });
+}
+
+void CallRecorder::write(const Record &record) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (mFd < 0) {
+        return;
+    }
+
+    // Start the ids over between calls, so the strings of one call never
+    // replace each other.
+    if (mStrings.size() + 3 > kMaxStrings ||
+            mStringBytes + record.sid.size() + record.fqName.size() + record.instance.size() >
+                    kMaxStringBytes) {
+        mStrings = {};
+        mStringBytes = 0;
+    }
+
+    // Define new strings before the call that refers to them.
+    const uint64_t sid = stringId(record.sid);
+    const uint64_t fqName = stringId(record.fqName);
+    const uint64_t instance = stringId(record.instance);
+    const uint64_t binder = binderId(record.binder);
+
+    mBuffer.push_back(kTagCall);
+    mBuffer.push_back(static_cast<uint8_t>(record.method));
+    mBuffer.push_back(record.flags);
+    mBuffer.push_back(record.result);
+    putVarint(static_cast<uint32_t>(record.pid));
+    putVarint(sid);
+    putVarint(fqName);
+    putVarint(instance);
+    putVarint(binder);
+    putVarint(record.arg);
+    putVarint(record.startMicros);
+    putVarint(record.durationNanos);
+
+    // The binder may be reused by an unrelated object from now on.
+    if (record.method == Method::SERVICE_DIED && record.binder != nullptr) {
+        mBinders.erase(record.binder);
+    }
+
+    if (mBuffer.size() >= kFlushBytes) {
+        flushLocked();
+    }
+}
+
+void CallRecorder::flush() {
+    std::lock_guard<std::mutex> lock(mLock);
+    flushLocked();
+}
+
+void CallRecorder::flushLocked() {
+    if (mBuffer.empty() || mFd < 0) {
+        return;
+    }
+    if (!::android::base::WriteFully(mFd, mBuffer.data(), mBuffer.size())) {
+        // A partial record would make the rest of the trace unreadable.
+        ALOGE("Failed to write call trace, recording stopped: %s", strerror(errno));
+        mFd.reset();
+    }
+    mBuffer.clear();
+}
+
+uint64_t CallRecorder::stringId(std::string_view str) {
+    if (str.empty()) {
+        return 0;
+    }
+    if (const uint64_t *id = mStrings.find(str)) {
+        return *id;
+    }
+
+    const uint64_t id = mStrings.size() + 1;
+    mStrings.insert(std::string(str), id);
+    mStringBytes += str.size();
+
+    mBuffer.push_back(kTagString);
+    putVarint(id);
+    putVarint(str.size());
+    mBuffer.insert(mBuffer.end(), str.begin(), str.end());
+    return id;
+}
+
+uint64_t CallRecorder::binderId(const void *binder) {
+    if (binder == nullptr) {
+        return 0;
+    }
+    // Ids keep counting up after binders are forgotten, so they're never reused.
+    if (const uint64_t *id = mBinders.find(binder)) {
+        return *id;
+    }
+    const uint64_t id = ++mLastBinderId;
+    mBinders.insert(binder, id);
+    return id;
+}
+
+void CallRecorder::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        mBuffer.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    mBuffer.push_back(static_cast<uint8_t>(value));
+}
+
+bool CallTraceReader::open(const std::string &path) {
+    std::string data;
+    if (!::android::base::ReadFileToString(path, &data)) {
+        return false;
+    }
+    if (data.size() < sizeof(CallRecorder::kMagic) ||
+        memcmp(data.data(), CallRecorder::kMagic, sizeof(CallRecorder::kMagic)) != 0) {
+        return false;
+    }
+    mData.assign(data.begin(), data.end());
+    mPos = sizeof(CallRecorder::kMagic);
+    mStrings.assign(1, "");
+    return true;
+}
+
+bool CallTraceReader::next(Call *call) {
+    while (mPos < mData.size()) {
+        const uint8_t tag = mData[mPos++];
+
+        if (tag == CallRecorder::kTagString) {
+            uint64_t id, length;
+            // A new id, or one the recorder started over with.
+            if (!getVarint(&id) || !getVarint(&length) || id == 0 || id > mStrings.size() ||
+                length > mData.size() - mPos) {
+                return false;
+            }
+            std::string str(reinterpret_cast<const char *>(&mData[mPos]), length);
+            if (id == mStrings.size()) {
+                mStrings.push_back(std::move(str));
+            } else {
+                mStrings[id] = std::move(str);
+            }
+            mPos += length;
+            continue;
+        }
+
+        if (tag != CallRecorder::kTagCall || mData.size() - mPos < 3) {
+            return false;
+        }
+        call->method = static_cast<CallRecorder::Method>(mData[mPos++]);
+        call->flags = mData[mPos++];
+        call->result = mData[mPos++];
+
+        uint64_t pid, sid, fqName, instance;
+        if (!getVarint(&pid) || !getString(&sid) || !getString(&fqName) ||
+            !getString(&instance) || !getVarint(&call->binder) || !getVarint(&call->arg) ||
+            !getVarint(&call->startMicros) || !getVarint(&call->durationNanos)) {
+            return false;
+        }
+        call->pid = static_cast<pid_t>(pid);
+        call->sid = mStrings[sid];
+        call->fqName = mStrings[fqName];
+        call->instance = mStrings[instance];
+        return true;
+    }
+    return false;
+}
+
+bool CallTraceReader::getVarint(uint64_t *value) {
+    *value = 0;
+    for (size_t shift = 0; shift < 64 && mPos < mData.size(); shift += 7) {
+        const uint8_t byte = mData[mPos++];
+        *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CallTraceReader::getString(uint64_t *id) {
+    return getVarint(id) && *id < mStrings.size();
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,206 @@
+#ifndef ANDROID_HARDWARE_MANAGER_CALLRECORDER_H
+#define ANDROID_HARDWARE_MANAGER_CALLRECORDER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+#include "AccessControlBackend.h"
+#include "FlatHashMap.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+/**
+ * Writes a compact binary trace of the calls served by ServiceManager and
+ * TokenManager, for hwservicemanager_replay to play back.
+ *
+ * Format, after the 8 byte kMagic: a sequence of records, each starting
+ * with a tag byte. Integers are unsigned LEB128 varints.
+ *   kTagString: id, length, bytes
+ *       Defines string id; every later record refers to it by id. Id 0 is
+ *       the empty string and is never defined. Once kMaxStrings strings
+ *       or kMaxStringBytes bytes were defined, ids start over at 1, and
+ *       each definition replaces the string previously defined with its
+ *       id.
+ *   kTagCall: method (1 byte), flags (1 byte), result (1 byte), pid, sid,
+ *             fqName, instance, binder, arg, startMicros, durationNanos
+ *       sid, fqName and instance are string ids. binder numbers the
+ *       binders seen (0 for none) in order of first appearance. Calls are
+ *       written when they return, so startMicros (since the trace began)
+ *       isn't sorted.
+ */
+class CallRecorder {
+public:
+    static constexpr char kMagic[8] = {'H', 'W', 'S', 'M', 'T', 'R', 'C', '1'};
+    static constexpr uint8_t kTagString = 1;
+    static constexpr uint8_t kTagCall = 2;
+
+    // Bounds on the strings the recorder remembers, see kTagString.
+    static constexpr size_t kMaxStrings = 4096;
+    static constexpr size_t kMaxStringBytes = 256 * 1024;
+
+    // bits in a call's flags
+    static constexpr uint8_t kFlagDenied = 1 << 0; // rejected by access control
+
+    /**
+     * Unless noted, result is the bool returned, or whether a service was
+     * returned, and flags has kFlagDenied if access control rejected it.
+     */
+    enum class Method : uint8_t {
+        GET = 1,
+        ADD,                    // fqName: interface chain joined with ','
+        GET_TRANSPORT,          // result: Transport
+        LIST,                   // arg: entries returned
+        LIST_BY_INTERFACE,      // arg: entries returned
+        REGISTER_FOR_NOTIFICATIONS,
+        UNREGISTER_FOR_NOTIFICATIONS,
+        REGISTER_PASSTHROUGH_CLIENT,
+        DEBUG_DUMP,
+        GET_SERVICES,           // fqName, instance: joined with ','; arg: services returned;
+                                // denied if any of them was
+        WAIT_FOR_SERVICE,       // arg: timeout in nanoseconds
+        LIST_PAGE,              // fqName: prefix; instance: cursor; arg: maxEntries
+        GET_GENERATION,
+        GET_CHANGES_SINCE,      // arg: 1 + generation minus ChangeJournal::firstGeneration(),
+                                // 0 if generation is older; result: whether no resync
+                                // was needed
+        SERVICE_DIED,           // binder: the service or listener that died; arg: cookie
+        CREATE_TOKEN,           // binder: the stored interface; arg: id of the token
+        GET_TOKEN,              // arg: token id
+        UNREGISTER_TOKEN,       // arg: token id
+    };
+
+    using CallerResolver = std::function<AccessControlBackend::CallingContext()>;
+
+    /**
+     * Starts a trace at path, truncating it. callerOf identifies the
+     * caller of the call being served. Returns nullptr on failure.
+     */
+    static std::shared_ptr<CallRecorder> open(const std::string &path, CallerResolver callerOf);
+
+    ~CallRecorder();
+
+    /**
+     * One call being recorded; written when destroyed. Does nothing if
+     * the recorder is null, so call sites don't need to check.
+     */
+    class Call {
+    public:
+        Call(CallRecorder *recorder, Method method,
+             std::string_view fqName = std::string_view(),
+             std::string_view instance = std::string_view());
+        ~Call();
+
+        Call(const Call &) = delete;
+        Call &operator=(const Call &) = delete;
+
+        void setFqName(std::string_view fqName) { if (mRecorder) mFqName = fqName; }
+        void setInstance(std::string_view instance) { if (mRecorder) mInstance = instance; }
+        void setDenied() { mFlags |= kFlagDenied; }
+        void setResult(uint8_t result) { mResult = result; }
+        void setArg(uint64_t arg) { mArg = arg; }
+        // identity only, e.g. the IBinder behind a service or listener
+        void setBinder(const void *binder) { mBinder = binder; }
+
+    private:
+        CallRecorder *mRecorder;
+        Method mMethod;
+        uint8_t mFlags = 0;
+        uint8_t mResult = 0;
+        std::string mFqName;
+        std::string mInstance;
+        const void *mBinder = nullptr;
+        uint64_t mArg = 0;
+        AccessControlBackend::CallingContext mCaller;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    // Writes out what is buffered.
+    void flush();
+
+private:
+    struct Record {
+        Method method;
+        uint8_t flags;
+        uint8_t result;
+        pid_t pid;
+        std::string_view sid;
+        std::string_view fqName;
+        std::string_view instance;
+        const void *binder;
+        uint64_t arg;
+        uint64_t startMicros;
+        uint64_t durationNanos;
+    };
+
+    CallRecorder(::android::base::unique_fd fd, CallerResolver callerOf);
+
+    void write(const Record &record);
+
+    // require mLock
+    uint64_t stringId(std::string_view str);
+    uint64_t binderId(const void *binder);
+    void putVarint(uint64_t value);
+    void flushLocked();
+
+    const CallerResolver mCallerOf;
+    const std::chrono::steady_clock::time_point mStart;
+
+    std::mutex mLock; // guards the members below
+    ::android::base::unique_fd mFd;
+    std::vector<uint8_t> mBuffer;
+    FlatHashMap<std::string, uint64_t, StringViewHash> mStrings;
+    size_t mStringBytes = 0; // total size of the keys of mStrings
+    FlatHashMap<const void *, uint64_t, PointerHash> mBinders;
+    uint64_t mLastBinderId = 0;
+};
+
+/**
+ * Reads a trace written by CallRecorder.
+ */
+class CallTraceReader {
+public:
+    struct Call {
+        CallRecorder::Method method;
+        uint8_t flags;
+        uint8_t result;
+        pid_t pid;
+        std::string sid;
+        std::string fqName;
+        std::string instance;
+        uint64_t binder;
+        uint64_t arg;
+        uint64_t startMicros;
+        uint64_t durationNanos;
+    };
+
+    // Returns false if path can't be read or isn't a trace.
+    bool open(const std::string &path);
+
+    // Reads the next call. Returns false at the end or on a corrupt record.
+    bool next(Call *call);
+
+private:
+    bool getVarint(uint64_t *value);
+    bool getString(uint64_t *id);
+
+    std::vector<uint8_t> mData;
+    size_t mPos = 0;
+    std::vector<std::string> mStrings{""};
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_CALLRECORDER_H
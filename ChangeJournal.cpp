@@ -0,0 +1,63 @@
+#include "ChangeJournal.h"
+
+#include <chrono>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+static uint64_t steadyClockNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ChangeJournal::ChangeJournal()
+      : mFirstGeneration(steadyClockNanos()),
+        mEntries(kCapacity),
+        mGeneration(mFirstGeneration) {}
+
+void ChangeJournal::record(RegistryChangeKind kind, InternedName fqName,
+                           InternedName instanceName) {
+    const uint64_t generation = mGeneration.load(std::memory_order_relaxed) + 1;
+    mEntries[(generation - 1) % kCapacity] = {kind, fqName, instanceName};
+    mGeneration.store(generation, std::memory_order_release);
+}
+
+uint64_t ChangeJournal::generation() const {
+    return mGeneration.load(std::memory_order_acquire);
+}
+
+bool ChangeJournal::changesSince(uint64_t generation, hidl_vec<RegistryChange> *changes) const {
+    const uint64_t current = mGeneration.load(std::memory_order_relaxed);
+
+    if (generation == current) {
+        changes->resize(0);
+        return true;
+    }
+    // Generations outside [mFirstGeneration, current] were handed out by an
+    // earlier instance of us.
+    if (generation < mFirstGeneration || generation > current ||
+            current - generation > kCapacity) {
+        changes->resize(0);
+        return false;
+    }
+
+    changes->resize(current - generation);
+    size_t i = 0;
+    for (uint64_t g = generation + 1; g <= current; g++) {
+        const Entry &entry = mEntries[(g - 1) % kCapacity];
+        (*changes)[i++] = {
+            .generation = g,
+            .kind = entry.kind,
+            .fqName = entry.fqName.str(),
+            .instanceName = entry.instanceName.str(),
+        };
+    }
+    return true;
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,75 @@
+#ifndef ANDROID_HARDWARE_MANAGER_CHANGEJOURNAL_H
+#define ANDROID_HARDWARE_MANAGER_CHANGEJOURNAL_H
+
+#include <atomic>
+#include <vector>
+
+#include <hidl/HidlSupport.h>
+#include <hwservicemanager/ext/1.0/types.h>
+
+#include "NamePool.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::hwservicemanager::ext::V1_0::RegistryChange;
+using ::hwservicemanager::ext::V1_0::RegistryChangeKind;
+
+/**
+ * Registry generation counter plus a ring buffer of the most recent
+ * changes, so clients can sync incrementally instead of re-listing.
+ *
+ * Every record() bumps the generation by one. record() and changesSince()
+ * must be serialized by the caller; generation() may be called from any
+ * thread.
+ *
+ * Generations start at the steady clock in nanoseconds rather than at 0.
+ * That clock is shared by every process and only moves forward during a
+ * boot, and far faster than changes are recorded, so a journal started
+ * after a restart of hwservicemanager begins above every generation the
+ * previous one handed out. Such a generation always forces a resync
+ * instead of matching unrelated changes.
+ */
+class ChangeJournal {
+public:
+    static constexpr size_t kCapacity = 1024;
+
+    ChangeJournal();
+
+    void record(RegistryChangeKind kind, InternedName fqName, InternedName instanceName);
+
+    uint64_t generation() const;
+
+    // The generation before the first change recorded here.
+    uint64_t firstGeneration() const { return mFirstGeneration; }
+
+    /**
+     * Returns the changes after generation, oldest first. Returns false if
+     * some of them were already overwritten or generation wasn't handed
+     * out by this journal, in which case the client has to resync with
+     * list().
+     */
+    bool changesSince(uint64_t generation, hidl_vec<RegistryChange> *changes) const;
+
+private:
+    struct Entry {
+        RegistryChangeKind kind;
+        InternedName fqName;
+        InternedName instanceName;
+    };
+
+    const uint64_t mFirstGeneration;
+    std::vector<Entry> mEntries; // entry of generation g at (g - 1) % kCapacity
+    std::atomic<uint64_t> mGeneration;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_CHANGEJOURNAL_H
@@ -0,0 +1,49 @@
+#include "Extensions.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+ServiceManagerExt::ServiceManagerExt(const sp<ServiceManager>& manager) : mManager(manager) {}
+
+Return<void> ServiceManagerExt::getServices(const hidl_vec<hidl_string>& fqNames,
+                                            const hidl_vec<hidl_string>& names,
+                                            getServices_cb _hidl_cb) {
+    return mManager->getServices(fqNames, names, _hidl_cb);
+}
+
+Return<sp<IBase>> ServiceManagerExt::waitForService(const hidl_string& fqName,
+                                                    const hidl_string& name,
+                                                    int64_t timeoutNanos) {
+    return mManager->waitForService(fqName, name, timeoutNanos);
+}
+
+Return<void> ServiceManagerExt::listPage(const hidl_string& prefix,
+                                         const hidl_string& cursor,
+                                         uint32_t maxEntries,
+                                         listPage_cb _hidl_cb) {
+    return mManager->listPage(prefix, cursor, maxEntries, _hidl_cb);
+}
+
+Return<uint64_t> ServiceManagerExt::getGeneration() {
+    return mManager->getGeneration();
+}
+
+Return<void> ServiceManagerExt::getChangesSince(uint64_t generation,
+                                                getChangesSince_cb _hidl_cb) {
+    return mManager->getChangesSince(generation, _hidl_cb);
+}
+
+TokenManagerExt::TokenManagerExt(const sp<TokenManager>& tokenManager)
+    : mTokenManager(tokenManager) {}
+
+Return<void> TokenManagerExt::createTokens(const hidl_vec<sp<IBase>>& stores,
+                                           createTokens_cb _hidl_cb) {
+    return mTokenManager->createTokens(stores, _hidl_cb);
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,65 @@
+#ifndef ANDROID_HARDWARE_MANAGER_EXTENSIONS_H
+#define ANDROID_HARDWARE_MANAGER_EXTENSIONS_H
+
+#include <hwservicemanager/ext/1.0/IServiceManagerExt.h>
+#include <hwservicemanager/ext/1.0/ITokenManagerExt.h>
+
+#include "ServiceManager.h"
+#include "TokenManager.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::token::V1_0::implementation::TokenManager;
+using ::hwservicemanager::ext::V1_0::IServiceManagerExt;
+using ::hwservicemanager::ext::V1_0::ITokenManagerExt;
+
+/**
+ * Serves the ServiceManager methods that aren't part of any
+ * android.hidl.manager version as hwservicemanager.ext@1.0. A separate
+ * object, since generated interfaces can't share one IBase.
+ */
+struct ServiceManagerExt : public IServiceManagerExt {
+    explicit ServiceManagerExt(const sp<ServiceManager>& manager);
+
+    // Methods from ::hwservicemanager::ext::V1_0::IServiceManagerExt follow.
+    Return<void> getServices(const hidl_vec<hidl_string>& fqNames,
+                             const hidl_vec<hidl_string>& names,
+                             getServices_cb _hidl_cb) override;
+    Return<sp<IBase>> waitForService(const hidl_string& fqName,
+                                     const hidl_string& name,
+                                     int64_t timeoutNanos) override;
+    Return<void> listPage(const hidl_string& prefix,
+                          const hidl_string& cursor,
+                          uint32_t maxEntries,
+                          listPage_cb _hidl_cb) override;
+    Return<uint64_t> getGeneration() override;
+    Return<void> getChangesSince(uint64_t generation, getChangesSince_cb _hidl_cb) override;
+
+private:
+    const sp<ServiceManager> mManager;
+};
+
+/**
+ * Serves the TokenManager methods that aren't part of android.hidl.token
+ * as hwservicemanager.ext@1.0.
+ */
+struct TokenManagerExt : public ITokenManagerExt {
+    explicit TokenManagerExt(const sp<TokenManager>& tokenManager);
+
+    // Methods from ::hwservicemanager::ext::V1_0::ITokenManagerExt follow.
+    Return<void> createTokens(const hidl_vec<sp<IBase>>& stores,
+                              createTokens_cb _hidl_cb) override;
+
+private:
+    const sp<TokenManager> mTokenManager;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_EXTENSIONS_H
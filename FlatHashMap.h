@@ -0,0 +1,247 @@
+#ifndef ANDROID_HARDWARE_MANAGER_FLATHASHMAP_H
+#define ANDROID_HARDWARE_MANAGER_FLATHASHMAP_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <hidl/HidlSupport.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+/**
+ * Views a hidl_string without copying it, so lookups keyed by std::string
+ * don't need to allocate a temporary.
+ */
+inline std::string_view toStringView(const ::android::hardware::hidl_string &str) {
+    return std::string_view(str.c_str(), str.size());
+}
+
+/**
+ * Hashes std::string and std::string_view alike, so tables keyed by
+ * std::string can be probed with a std::string_view.
+ */
+struct StringViewHash {
+    size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+/**
+ * Hashes pointers used as identities. Objects are aligned, so the address
+ * is mixed before FlatHashMap masks off its low bits.
+ */
+struct PointerHash {
+    size_t operator()(const void *ptr) const {
+        uint64_t h = reinterpret_cast<uintptr_t>(ptr) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+};
+
+/**
+ * Open addressing (linear probing) hash table with inline entries.
+ *
+ * Every slot stores the cached hash next to the entry, so a probe only
+ * compares keys whose hashes match and a hit usually touches a single slot.
+ * Lookups are heterogeneous: find() accepts any type that Hash and KeyEqual
+ * both accept, e.g. a std::string_view into a table keyed by std::string.
+ *
+ * Iteration order is unspecified. Pointers to values are invalidated when
+ * an insertion grows the table or an erase shifts entries.
+ */
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<>>
+class FlatHashMap {
+    struct Slot {
+        size_t hash = 0;
+        bool occupied = false;
+        std::pair<Key, Value> entry{};
+    };
+
+public:
+    template <typename SlotT, typename EntryT>
+    class Iterator {
+    public:
+        Iterator(SlotT *slot, SlotT *end) : mSlot(slot), mEnd(end) { skipEmpty(); }
+
+        EntryT &operator*() const { return mSlot->entry; }
+        EntryT *operator->() const { return &mSlot->entry; }
+        Iterator &operator++() {
+            ++mSlot;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const Iterator &other) const { return mSlot == other.mSlot; }
+        bool operator!=(const Iterator &other) const { return mSlot != other.mSlot; }
+
+    private:
+        void skipEmpty() {
+            while (mSlot != mEnd && !mSlot->occupied) ++mSlot;
+        }
+
+        SlotT *mSlot;
+        SlotT *mEnd;
+    };
+
+    using iterator = Iterator<Slot, std::pair<Key, Value>>;
+    using const_iterator = Iterator<const Slot, const std::pair<Key, Value>>;
+
+    iterator begin() { return iterator(mSlots.data(), mSlots.data() + mSlots.size()); }
+    iterator end() { return iterator(mSlots.data() + mSlots.size(), mSlots.data() + mSlots.size()); }
+    const_iterator begin() const {
+        return const_iterator(mSlots.data(), mSlots.data() + mSlots.size());
+    }
+    const_iterator end() const {
+        return const_iterator(mSlots.data() + mSlots.size(), mSlots.data() + mSlots.size());
+    }
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    void reserve(size_t count) {
+        size_t capacity = kMinCapacity;
+        while (!fits(count, capacity)) capacity *= 2;
+        if (capacity > mSlots.size()) rehash(capacity);
+    }
+
+    /**
+     * Returns the value stored under key, or nullptr. Never allocates.
+     */
+    template <typename Q>
+    Value *find(const Q &key) {
+        return const_cast<Value *>(const_cast<const FlatHashMap *>(this)->find(key));
+    }
+
+    template <typename Q>
+    const Value *find(const Q &key) const {
+        if (mSize == 0) return nullptr;
+
+        const size_t hash = Hash{}(key);
+        const size_t mask = mSlots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Slot &slot = mSlots[i];
+            if (!slot.occupied) return nullptr;
+            if (slot.hash == hash && KeyEqual{}(slot.entry.first, key)) {
+                return &slot.entry.second;
+            }
+        }
+    }
+
+    /**
+     * Returns the value stored under key, default-constructing it (and
+     * constructing a Key from key) if it isn't present yet.
+     */
+    template <typename Q>
+    Value &operator[](const Q &key) {
+        const size_t hash = Hash{}(key);
+        if (Value *value = findWithHash(key, hash)) return *value;
+        return insertNew(hash, Key(key), Value())->second;
+    }
+
+    /**
+     * Inserts value under key unless key is already present. Returns the
+     * stored value and whether it was inserted.
+     */
+    std::pair<Value *, bool> insert(Key key, Value value) {
+        const size_t hash = Hash{}(key);
+        if (Value *existing = findWithHash(key, hash)) return {existing, false};
+        return {&insertNew(hash, std::move(key), std::move(value))->second, true};
+    }
+
+    /**
+     * Removes key if present. Uses backward-shift deletion, so the table
+     * never accumulates tombstones.
+     */
+    template <typename Q>
+    bool erase(const Q &key) {
+        if (mSize == 0) return false;
+
+        const size_t hash = Hash{}(key);
+        const size_t mask = mSlots.size() - 1;
+        size_t i = hash & mask;
+        for (;; i = (i + 1) & mask) {
+            const Slot &slot = mSlots[i];
+            if (!slot.occupied) return false;
+            if (slot.hash == hash && KeyEqual{}(slot.entry.first, key)) break;
+        }
+
+        for (size_t j = (i + 1) & mask; mSlots[j].occupied; j = (j + 1) & mask) {
+            const size_t home = mSlots[j].hash & mask;
+            // Move slot j into the hole at i unless its home lies cyclically in (i, j].
+            const bool homeBetween = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+            if (!homeBetween) {
+                mSlots[i] = std::move(mSlots[j]);
+                i = j;
+            }
+        }
+        mSlots[i] = Slot();
+        --mSize;
+        return true;
+    }
+
+private:
+    static constexpr size_t kMinCapacity = 16;
+
+    // Keep the load factor at or below 3/4 so probe sequences stay short.
+    static bool fits(size_t count, size_t capacity) { return count * 4 <= capacity * 3; }
+
+    template <typename Q>
+    Value *findWithHash(const Q &key, size_t hash) {
+        if (mSize == 0) return nullptr;
+
+        const size_t mask = mSlots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot &slot = mSlots[i];
+            if (!slot.occupied) return nullptr;
+            if (slot.hash == hash && KeyEqual{}(slot.entry.first, key)) {
+                return &slot.entry.second;
+            }
+        }
+    }
+
+    std::pair<Key, Value> *insertNew(size_t hash, Key &&key, Value &&value) {
+        if (mSlots.empty() || !fits(mSize + 1, mSlots.size())) {
+            rehash(mSlots.empty() ? kMinCapacity : mSlots.size() * 2);
+        }
+        Slot &slot = emptySlotFor(hash);
+        slot.hash = hash;
+        slot.occupied = true;
+        slot.entry.first = std::move(key);
+        slot.entry.second = std::move(value);
+        ++mSize;
+        return &slot.entry;
+    }
+
+    Slot &emptySlotFor(size_t hash) {
+        const size_t mask = mSlots.size() - 1;
+        size_t i = hash & mask;
+        while (mSlots[i].occupied) i = (i + 1) & mask;
+        return mSlots[i];
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(mSlots);
+        for (Slot &slot : old) {
+            if (!slot.occupied) continue;
+            emptySlotFor(slot.hash) = std::move(slot);
+        }
+    }
+
+    std::vector<Slot> mSlots;
+    size_t mSize = 0;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_FLATHASHMAP_H
@@ -11,8 +11,8 @@ namespace manager {
 namespace implementation {
 
 HidlService::HidlService(
-    const std::string &interfaceName,
-    const std::string &instanceName,
+    InternedName interfaceName,
+    InternedName instanceName,
     const sp<IBase> &service,
     pid_t pid)
 : mInterfaceName(interfaceName),
@@ -27,82 +27,74 @@ sp<IBase> HidlService::getService() const {
 void HidlService::setService(sp<IBase> service, pid_t pid) {
     mService = service;
     mPid = pid;
-
-    sendRegistrationNotifications();
+    if (mService != nullptr) {
+        mRegistration++;
+    }
+}
+uint64_t HidlService::getRegistration() const {
+    return mRegistration;
 }
 
 pid_t HidlService::getDebugPid() const {
     return mPid;
 }
 const std::string &HidlService::getInterfaceName() const {
-    return mInterfaceName;
+    return mInterfaceName.str();
 }
 const std::string &HidlService::getInstanceName() const {
+    return mInstanceName.str();
+}
+InternedName HidlService::getInternedInterfaceName() const {
+    return mInterfaceName;
+}
+InternedName HidlService::getInternedInstanceName() const {
     return mInstanceName;
 }
 
-void HidlService::addListener(const sp<IServiceNotification> &listener) {
+bool HidlService::addListener(const sp<IServiceNotification> &listener,
+                              NotificationQueue &notifications) {
+    if (!mListeners.insert(identityOf(listener), listener).second) {
+        return false;
+    }
+
     if (mService != nullptr) {
-        auto ret = listener->onRegistration(
-            mInterfaceName, mInstanceName, true /* preexisting */);
-        if (!ret.isOk()) {
-            LOG(ERROR) << "Not adding listener for " << mInterfaceName << "/"
-                       << mInstanceName << ": transport error when sending "
-                       << "notification for already registered instance.";
-            return;
-        }
+        notifications.enqueue(listener, mInterfaceName, mInstanceName, mRegistration,
+                              true /* preexisting */);
     }
-    mListeners.push_back(listener);
+    return true;
 }
 
-bool HidlService::removeListener(const wp<IBase>& listener) {
-    using ::android::hardware::interfacesEqual;
-
-    bool found = false;
-
-    for (auto it = mListeners.begin(); it != mListeners.end();) {
-        if (interfacesEqual(*it, listener.promote())) {
-            it = mListeners.erase(it);
-            found = true;
-        } else {
-            ++it;
-        }
-    }
+bool HidlService::removeListener(const sp<IBase>& listener) {
+    return mListeners.erase(identityOf(listener));
+}
 
-    return found;
+void HidlService::registerPassthroughClient(pid_t pid, uint64_t startTime) {
+    mPassthroughClients.add(pid, startTime);
 }
 
-void HidlService::registerPassthroughClient(pid_t pid) {
-    mPassthroughClients.insert(pid);
+void HidlService::removePassthroughClients(
+        const std::vector<PassthroughClients::Client> &clients) {
+    mPassthroughClients.remove(clients);
 }
 
-const std::set<pid_t> &HidlService::getPassthroughClients() const {
+const PassthroughClients &HidlService::getPassthroughClients() const {
     return mPassthroughClients;
 }
 
 std::string HidlService::string() const {
     std::stringstream ss;
-    ss << mInterfaceName << "/" << mInstanceName;
+    ss << mInterfaceName.str() << "/" << mInstanceName.str();
     return ss.str();
 }
 
-void HidlService::sendRegistrationNotifications() {
-    if (mListeners.size() == 0 || mService == nullptr) {
+void HidlService::sendRegistrationNotifications(NotificationQueue &notifications) const {
+    if (mService == nullptr) {
         return;
     }
 
-    hidl_string iface = mInterfaceName;
-    hidl_string name = mInstanceName;
-
-    for (auto it = mListeners.begin(); it != mListeners.end();) {
-        auto ret = (*it)->onRegistration(iface, name, false /* preexisting */);
-        if (ret.isOk()) {
-            ++it;
-        } else {
-            LOG(ERROR) << "Dropping registration callback for " << iface << "/" << name
-                       << ": transport error.";
-            it = mListeners.erase(it);
-        }
+    for (const auto &listener : mListeners) {
+        notifications.enqueue(listener.second, mInterfaceName, mInstanceName, mRegistration,
+                              false /* preexisting */);
     }
 }
 
@@ -1,12 +1,15 @@
 #ifndef ANDROID_HARDWARE_MANAGER_HIDLSERVICE_H
 #define ANDROID_HARDWARE_MANAGER_HIDLSERVICE_H
 
-#include <set>
-
 #include <android/hidl/manager/1.1/IServiceManager.h>
 #include <hidl/Status.h>
 #include <hidl/MQDescriptor.h>
 
+#include "ListenerRegistry.h"
+#include "NamePool.h"
+#include "NotificationQueue.h"
+#include "PassthroughClients.h"
+
 namespace android {
 namespace hidl {
 namespace manager {
@@ -22,12 +25,12 @@ using ::android::hidl::manager::V1_1::IServiceManager;
 using ::android::sp;
 
 struct HidlService {
-    HidlService(const std::string &interfaceName,
-                const std::string &instanceName,
+    HidlService(InternedName interfaceName,
+                InternedName instanceName,
                 const sp<IBase> &service,
                 const pid_t pid);
-    HidlService(const std::string &interfaceName,
-                const std::string &instanceName)
+    HidlService(InternedName interfaceName,
+                InternedName instanceName)
     : HidlService(
         interfaceName,
         instanceName,
@@ -40,27 +43,40 @@ struct HidlService {
      * with registered IServiceNotification objects but no service registered yet.
      */
     sp<IBase> getService() const;
+    // Listeners aren't notified until sendRegistrationNotifications() is called.
     void setService(sp<IBase> service, pid_t pid);
+    // How many services were set here so far, identifying the current one.
+    uint64_t getRegistration() const;
     pid_t getDebugPid() const;
     const std::string &getInterfaceName() const;
     const std::string &getInstanceName() const;
+    InternedName getInternedInterfaceName() const;
+    InternedName getInternedInstanceName() const;
 
-    void addListener(const sp<IServiceNotification> &listener);
-    bool removeListener(const wp<IBase> &listener);
-    void registerPassthroughClient(pid_t pid);
+    /**
+     * Queues a preexisting notification if there is a service already.
+     * Returns false, doing nothing, if listener was added before.
+     */
+    bool addListener(const sp<IServiceNotification> &listener,
+                     NotificationQueue &notifications);
+    bool removeListener(const sp<IBase> &listener);
+    // startTime as returned by PassthroughClients::processStartTime(pid).
+    void registerPassthroughClient(pid_t pid, uint64_t startTime);
+    void removePassthroughClients(const std::vector<PassthroughClients::Client> &clients);
 
     std::string string() const; // e.x. "android.hidl.manager@1.0::IServiceManager/manager"
-    const std::set<pid_t> &getPassthroughClients() const;
+    const PassthroughClients &getPassthroughClients() const;
 
-private:
-    void sendRegistrationNotifications();
+    void sendRegistrationNotifications(NotificationQueue &notifications) const;
 
-    const std::string                     mInterfaceName; // e.x. "android.hidl.manager@1.0::IServiceManager"
-    const std::string                     mInstanceName;  // e.x. "manager"
+private:
+    const InternedName                    mInterfaceName; // e.x. "android.hidl.manager@1.0::IServiceManager"
+    const InternedName                    mInstanceName;  // e.x. "manager"
     sp<IBase>                             mService;
+    uint64_t                              mRegistration = 0;
 
-    std::vector<sp<IServiceNotification>> mListeners{};
-    std::set<pid_t>                       mPassthroughClients{};
+    ListenerSet                           mListeners{};
+    PassthroughClients                    mPassthroughClients{};
     pid_t                                 mPid = static_cast<pid_t>(IServiceManager::PidConstant::NO_PID);
 };
 
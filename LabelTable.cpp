@@ -0,0 +1,91 @@
+#include "LabelTable.h"
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+
+namespace android {
+
+static constexpr std::string_view kWildcard = "*";
+static constexpr std::string_view kWhitespace = " \t\r";
+
+const std::vector<std::string>& LabelTable::defaultPaths() {
+    static const std::vector<std::string> kPaths = {
+        "/system/etc/selinux/plat_hwservice_contexts",
+        "/system_ext/etc/selinux/system_ext_hwservice_contexts",
+        "/product/etc/selinux/product_hwservice_contexts",
+        "/vendor/etc/selinux/vendor_hwservice_contexts",
+        "/odm/etc/selinux/odm_hwservice_contexts",
+    };
+    return kPaths;
+}
+
+bool LabelTable::load(const std::vector<std::string>& paths) {
+    bool loaded = false;
+
+    for (const std::string& path : paths) {
+        std::string contents;
+        if (!android::base::ReadFileToString(path, &contents)) {
+            continue;
+        }
+        loaded = true;
+
+        std::string_view remaining = contents;
+        while (!remaining.empty()) {
+            size_t end = remaining.find('\n');
+            std::string_view line = remaining.substr(0, end);
+            remaining = (end == std::string_view::npos) ? std::string_view()
+                                                        : remaining.substr(end + 1);
+
+            // "<name> <context>", with '#' comments
+            line = line.substr(0, line.find('#'));
+            size_t nameStart = line.find_first_not_of(kWhitespace);
+            if (nameStart == std::string_view::npos) {
+                continue;
+            }
+            line = line.substr(nameStart);
+            size_t nameEnd = line.find_first_of(kWhitespace);
+            if (nameEnd == std::string_view::npos) {
+                continue;
+            }
+            std::string_view name = line.substr(0, nameEnd);
+            line = line.substr(nameEnd);
+            size_t contextStart = line.find_first_not_of(kWhitespace);
+            if (contextStart == std::string_view::npos) {
+                continue;
+            }
+            line = line.substr(contextStart);
+            std::string_view context = line.substr(0, line.find_first_of(kWhitespace));
+
+            addEntry(name, context);
+        }
+    }
+
+    return loaded;
+}
+
+void LabelTable::addEntry(std::string_view name, std::string_view context) {
+    if (name == kWildcard || mEntries.find(name) != nullptr) {
+        return;
+    }
+
+    uint32_t index = 0;
+    while (index < mContexts.size() && mContexts[index] != context) {
+        index++;
+    }
+    if (index == mContexts.size()) {
+        mContexts.emplace_back(context);
+    }
+
+    mEntries.insert(std::string(name), index);
+}
+
+const std::string* LabelTable::lookup(std::string_view interface) const {
+    const uint32_t* index = mEntries.find(interface);
+    return index != nullptr ? &mContexts[*index] : nullptr;
+}
+
+bool LabelTable::empty() const {
+    return mEntries.empty();
+}
+
+} // namespace android
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FlatHashMap.h"
+
+namespace android {
+
+/**
+ * In-memory copy of the exact entries of hwservice_contexts: interface
+ * name -> target context. Each distinct context is stored once. The "*"
+ * default is left out; names without an entry of their own are for
+ * selabel_lookup() to label, since they may have one in a file this
+ * table didn't read.
+ *
+ * Immutable once loaded, so a loaded table can be shared between threads.
+ */
+class LabelTable {
+public:
+    /**
+     * hwservice_contexts files in the order libselinux loads them. Only a
+     * copy of libselinux's list, which it doesn't export; AccessControl
+     * checks a loaded table against selabel_lookup() before using it.
+     */
+    static const std::vector<std::string>& defaultPaths();
+
+    /**
+     * Adds the entries of the given hwservice_contexts files. Files that
+     * can't be read are skipped; for duplicate names the first file wins.
+     * Returns false if no file could be read.
+     */
+    bool load(const std::vector<std::string>& paths);
+
+    /**
+     * Returns the context of interface (e.x. "android.hardware.foo::IFoo"),
+     * or nullptr if it has no entry of its own.
+     */
+    const std::string* lookup(std::string_view interface) const;
+
+    bool empty() const;
+
+    /**
+     * Calls f(name, context) for every entry.
+     */
+    template <typename F>
+    void forEach(F f) const {
+        for (const auto& entry : mEntries) {
+            f(entry.first, mContexts[entry.second]);
+        }
+    }
+
+private:
+    void addEntry(std::string_view name, std::string_view context);
+
+    std::vector<std::string> mContexts;
+    ::android::hidl::manager::implementation::FlatHashMap<
+        std::string, uint32_t, ::android::hidl::manager::implementation::StringViewHash>
+        mEntries; // name -> index into mContexts
+};
+
+} // namespace android
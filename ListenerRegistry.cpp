@@ -0,0 +1,68 @@
+#include "ListenerRegistry.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+void ListenerRegistry::add(const sp<IBase> &listener, const Subscription &subscription) {
+    Record &record = mRecords[identityOf(listener)];
+    if (record.listener == nullptr) {
+        record.listener = listener;
+    }
+    record.subscriptions.push_back(subscription);
+}
+
+bool ListenerRegistry::contains(const sp<IBase> &listener,
+                                const Subscription &subscription) const {
+    const Record *record = mRecords.find(identityOf(listener));
+    if (record == nullptr) {
+        return false;
+    }
+
+    for (const Subscription &existing : record->subscriptions) {
+        if (existing.interfaceName == subscription.interfaceName &&
+            existing.instanceName == subscription.instanceName) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<ListenerRegistry::Subscription> ListenerRegistry::remove(
+        const sp<IBase> &listener, InternedName interfaceName, InternedName instanceName) {
+    if (listener == nullptr) {
+        return {};
+    }
+
+    const void *identity = identityOf(listener);
+    Record *record = mRecords.find(identity);
+    if (record == nullptr) {
+        return {};
+    }
+
+    std::vector<Subscription> removed;
+    std::vector<Subscription> &subscriptions = record->subscriptions;
+    for (auto it = subscriptions.begin(); it != subscriptions.end();) {
+        bool matches = !interfaceName ||
+                (it->interfaceName == interfaceName &&
+                 (!instanceName || it->instanceName == instanceName));
+        if (matches) {
+            removed.push_back(*it);
+            it = subscriptions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (subscriptions.empty()) {
+        mRecords.erase(identity);
+    }
+
+    return removed;
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,71 @@
+#ifndef ANDROID_HARDWARE_MANAGER_LISTENERREGISTRY_H
+#define ANDROID_HARDWARE_MANAGER_LISTENERREGISTRY_H
+
+#include <vector>
+
+#include <android/hidl/manager/1.1/IServiceManager.h>
+
+#include "BinderIdentity.h"
+#include "FlatHashMap.h"
+#include "NamePool.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::manager::V1_0::IServiceNotification;
+
+/**
+ * Listeners of one HidlService or interface, keyed by identityOf() so a
+ * listener that registers twice is only stored (and notified) once. The
+ * stored listener keeps its key valid.
+ */
+using ListenerSet = FlatHashMap<const void *, sp<IServiceNotification>, PointerHash>;
+
+/**
+ * Records where each IServiceNotification is subscribed, keyed by the
+ * listener's identityOf(), so removing a listener only visits its own
+ * subscriptions instead of every entry in the registry.
+ *
+ * This is bookkeeping only; the listeners themselves still live in
+ * HidlService and PackageInterfaceMap.
+ */
+class ListenerRegistry {
+public:
+    struct Subscription {
+        InternedName interfaceName;
+        InternedName instanceName; // null for package listeners
+    };
+
+    void add(const sp<IBase> &listener, const Subscription &subscription);
+
+    // Whether listener already holds exactly this subscription.
+    bool contains(const sp<IBase> &listener, const Subscription &subscription) const;
+
+    /**
+     * Forgets and returns the subscriptions of listener that match:
+     *   - every subscription if interfaceName is null,
+     *   - every subscription on interfaceName (package and instances) if
+     *     only instanceName is null,
+     *   - the subscription on interfaceName/instanceName otherwise.
+     */
+    std::vector<Subscription> remove(const sp<IBase> &listener,
+                                     InternedName interfaceName = InternedName(),
+                                     InternedName instanceName = InternedName());
+
+private:
+    struct Record {
+        sp<IBase> listener; // keeps the key valid while the record exists
+        std::vector<Subscription> subscriptions;
+    };
+
+    FlatHashMap<const void *, Record, PointerHash> mRecords;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_LISTENERREGISTRY_H
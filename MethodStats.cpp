@@ -0,0 +1,141 @@
+#include "MethodStats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace android {
+
+size_t LatencyHistogram::bucketFor(uint64_t nanos) {
+    if (nanos < kSubBuckets) {
+        return nanos;
+    }
+    // nanos has its top bit at msb >= 2; the two bits below it pick the sub-bucket.
+    const size_t msb = 63 - __builtin_clzll(nanos);
+    const size_t sub = (nanos >> (msb - 2)) & (kSubBuckets - 1);
+    return (msb - 1) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    const size_t msb = bucket / kSubBuckets + 1;
+    const uint64_t sub = bucket % kSubBuckets;
+    const uint64_t width = uint64_t(1) << (msb - 2);
+    return (kSubBuckets + sub) * width + (width - 1);
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+    mBuckets[bucketFor(nanos)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mTotalNanos.fetch_add(nanos, std::memory_order_relaxed);
+
+    uint64_t max = mMaxNanos.load(std::memory_order_relaxed);
+    while (nanos > max &&
+           !mMaxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count() const {
+    return mCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::totalNanos() const {
+    return mTotalNanos.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::maxNanos() const {
+    return mMaxNanos.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentileNanos(double percentile) const {
+    // Buckets are read one by one while other threads record, so sum them
+    // here rather than trusting mCount to match.
+    std::array<uint64_t, kBuckets> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(total * percentile / 100));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(i), maxNanos());
+        }
+    }
+    return maxNanos();
+}
+
+MethodStats::MethodStats(std::vector<const char*> methodNames,
+                         std::vector<const char*> counterNames)
+    : mMethodNames(std::move(methodNames)),
+      mCounterNames(std::move(counterNames)),
+      mHistograms(new LatencyHistogram[mMethodNames.size()]),
+      mCounters(new std::atomic<uint64_t>[mCounterNames.size()]()) {}
+
+MethodStats::Timer::~Timer() {
+    auto elapsed = std::chrono::steady_clock::now() - mStart;
+    mStats.record(mMethod, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void MethodStats::record(size_t method, uint64_t nanos) {
+    mHistograms[method].record(nanos);
+}
+
+void MethodStats::increment(size_t counter) {
+    mCounters[counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t MethodStats::counter(size_t counter) const {
+    return mCounters[counter].load(std::memory_order_relaxed);
+}
+
+const LatencyHistogram& MethodStats::histogram(size_t method) const {
+    return mHistograms[method];
+}
+
+static std::string micros(uint64_t nanos) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << nanos / 1000.0;
+    return ss.str();
+}
+
+std::string MethodStats::dump() const {
+    std::stringstream ss;
+
+    ss << std::left << std::setw(28) << "method" << std::right
+       << std::setw(10) << "calls"
+       << std::setw(10) << "mean_us"
+       << std::setw(10) << "p50_us"
+       << std::setw(10) << "p90_us"
+       << std::setw(10) << "p99_us"
+       << std::setw(10) << "max_us" << std::endl;
+
+    for (size_t i = 0; i < mMethodNames.size(); i++) {
+        const LatencyHistogram& histogram = mHistograms[i];
+        const uint64_t count = histogram.count();
+
+        ss << std::left << std::setw(28) << mMethodNames[i] << std::right
+           << std::setw(10) << count
+           << std::setw(10) << micros(count == 0 ? 0 : histogram.totalNanos() / count)
+           << std::setw(10) << micros(histogram.percentileNanos(50))
+           << std::setw(10) << micros(histogram.percentileNanos(90))
+           << std::setw(10) << micros(histogram.percentileNanos(99))
+           << std::setw(10) << micros(histogram.maxNanos()) << std::endl;
+    }
+
+    for (size_t i = 0; i < mCounterNames.size(); i++) {
+        ss << mCounterNames[i] << ": " << counter(i) << std::endl;
+    }
+
+    return ss.str();
+}
+
+}  // namespace android
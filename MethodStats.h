@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace android {
+
+/**
+ * Latency histogram with log-linear buckets: every power of two is split
+ * into kSubBuckets equal buckets, so any recorded value is reported within
+ * 25% of its true value. Recording is a handful of relaxed atomic adds and
+ * never blocks.
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t kSubBuckets = 4;
+    static constexpr size_t kBuckets = 63 * kSubBuckets;
+
+    void record(uint64_t nanos);
+
+    uint64_t count() const;
+    uint64_t totalNanos() const;
+    uint64_t maxNanos() const;
+
+    /**
+     * Returns the upper bound of the bucket holding the given percentile
+     * (0 < percentile <= 100), or 0 if nothing was recorded.
+     */
+    uint64_t percentileNanos(double percentile) const;
+
+    static size_t bucketFor(uint64_t nanos);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> mBuckets{};
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mTotalNanos{0};
+    std::atomic<uint64_t> mMaxNanos{0};
+};
+
+/**
+ * Latency histograms for a fixed set of methods plus a fixed set of event
+ * counters, cheap enough to leave enabled in production builds.
+ *
+ * Methods and counters are identified by their index into the name lists
+ * given to the constructor; callers use an enum for them.
+ */
+class MethodStats {
+public:
+    MethodStats(std::vector<const char*> methodNames, std::vector<const char*> counterNames);
+
+    /**
+     * Records the time from construction to destruction against a method.
+     */
+    class Timer {
+    public:
+        Timer(MethodStats& stats, size_t method)
+            : mStats(stats), mMethod(method), mStart(std::chrono::steady_clock::now()) {}
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        MethodStats& mStats;
+        size_t mMethod;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    Timer time(size_t method) { return Timer(*this, method); }
+
+    void record(size_t method, uint64_t nanos);
+    void increment(size_t counter);
+
+    uint64_t counter(size_t counter) const;
+    const LatencyHistogram& histogram(size_t method) const;
+
+    /**
+     * One line per method with calls, mean, p50, p90, p99 and max in
+     * microseconds, followed by the counters.
+     */
+    std::string dump() const;
+
+private:
+    std::vector<const char*> mMethodNames;
+    std::vector<const char*> mCounterNames;
+    std::unique_ptr<LatencyHistogram[]> mHistograms;
+    std::unique_ptr<std::atomic<uint64_t>[]> mCounters;
+};
+
+}  // namespace android
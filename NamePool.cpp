@@ -0,0 +1,45 @@
+#include "NamePool.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+NamePool::NamePool(size_t maxBytes) : mMaxBytes(maxBytes) {}
+
+InternedName NamePool::intern(std::string_view name) {
+    const std::string *const *existing = mIndex.find(name);
+    if (existing != nullptr) {
+        return InternedName(*existing);
+    }
+
+    if (name.size() > mMaxBytes - mBytes) {
+        return InternedName();
+    }
+    mBytes += name.size();
+    mStrings.emplace_back(name);
+    const std::string *stored = &mStrings.back();
+    mIndex.insert(std::string_view(*stored), stored);
+    return InternedName(stored);
+}
+
+InternedName NamePool::find(std::string_view name) const {
+    const std::string *const *existing = mIndex.find(name);
+    if (existing == nullptr) {
+        return InternedName();
+    }
+    return InternedName(*existing);
+}
+
+size_t NamePool::size() const {
+    return mStrings.size();
+}
+
+size_t NamePool::bytes() const {
+    return mBytes;
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,92 @@
+#ifndef ANDROID_HARDWARE_MANAGER_NAMEPOOL_H
+#define ANDROID_HARDWARE_MANAGER_NAMEPOOL_H
+
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include "FlatHashMap.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+/**
+ * Handle to a string owned by a NamePool. Two handles from the same pool
+ * are equal iff their strings are equal, so comparing and hashing them
+ * never looks at the bytes.
+ */
+class InternedName {
+public:
+    InternedName() = default;
+
+    const std::string &str() const { return *mStr; }
+    std::string_view view() const { return *mStr; }
+
+    // false for the default-constructed (missing) name
+    explicit operator bool() const { return mStr != nullptr; }
+
+    bool operator==(const InternedName &other) const { return mStr == other.mStr; }
+    bool operator!=(const InternedName &other) const { return mStr != other.mStr; }
+
+    struct Hash {
+        size_t operator()(const InternedName &name) const {
+            return PointerHash{}(name.mStr);
+        }
+    };
+
+private:
+    friend class NamePool;
+    explicit InternedName(const std::string *str) : mStr(str) {}
+
+    const std::string *mStr = nullptr;
+};
+
+/**
+ * Append-only table of interface and instance names.
+ *
+ * Each distinct name is stored once for the lifetime of the pool, no
+ * matter how many HidlService entries refer to it (e.g.
+ * "android.hidl.base@1.0::IBase" or "default"). Names are never freed,
+ * since snapshots, journal entries and queued notifications may still
+ * refer to them, so the pool only takes names that are registered and
+ * stops taking new ones at maxBytes.
+ */
+class NamePool {
+public:
+    // Far more than the names of every HAL a device registers.
+    static constexpr size_t kDefaultMaxBytes = 1 << 20;
+
+    explicit NamePool(size_t maxBytes = kDefaultMaxBytes);
+
+    /**
+     * Returns the handle for name, adding it to the pool if needed, or a
+     * null handle if name is new and would take the pool over maxBytes.
+     */
+    InternedName intern(std::string_view name);
+
+    /**
+     * Returns the handle for name, or a null handle if name was never
+     * interned. Never allocates.
+     */
+    InternedName find(std::string_view name) const;
+
+    size_t size() const;
+
+    // Bytes of all names in the pool.
+    size_t bytes() const;
+
+private:
+    const size_t mMaxBytes;
+    size_t mBytes = 0;
+    std::deque<std::string> mStrings; // never moves its elements
+    FlatHashMap<std::string_view, const std::string *, StringViewHash> mIndex;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_NAMEPOOL_H
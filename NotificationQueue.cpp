@@ -0,0 +1,272 @@
+#define LOG_TAG "hwservicemanager"
+#include "NotificationQueue.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <tuple>
+
+#include <android-base/logging.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::hwservicemanager::ext::V1_0::Registration;
+using std::chrono::steady_clock;
+
+// Interned names live as long as the manager, so they can be sent without copying.
+static hidl_string toHidlString(InternedName name) {
+    hidl_string str;
+    str.setToExternal(name.str().c_str(), name.str().size());
+    return str;
+}
+
+NotificationQueue::NotificationQueue(DropCallback onDrop)
+    : mOnDrop(std::move(onDrop)),
+      mStats({"onRegistration", "onRegistrations"}, {"retried", "overflow", "quarantined"}),
+      mThread([this] { run(); }) {}
+
+NotificationQueue::~NotificationQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+    }
+    mWakeup.notify_one();
+    mThread.join();
+}
+
+void NotificationQueue::enqueue(const sp<IServiceNotification> &listener,
+                                InternedName fqName,
+                                InternedName instanceName,
+                                uint64_t registration,
+                                bool preexisting) {
+    const void *identity = identityOf(listener);
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    ListenerState &state = mListeners[identity];
+    if (state.listener == nullptr) {
+        state.listener = listener;
+    }
+    if (state.drop) {
+        return;
+    }
+
+    for (const Notification &queued : state.pending) {
+        if (queued.fqName == fqName && queued.instanceName == instanceName &&
+            queued.registration == registration && queued.preexisting == preexisting) {
+            return;
+        }
+    }
+
+    if (state.pending.size() >= kMaxPending) {
+        LOG(ERROR) << "Quarantining registration listener: " << state.pending.size()
+                   << " notifications pending.";
+        mStats.increment(kOverflow);
+        state.pending.clear();
+        state.drop = DropReason::QUEUE_FULL;
+        return;
+    }
+
+    state.pending.push_back({fqName, instanceName, registration, preexisting});
+}
+
+void NotificationQueue::flush() {
+    mWakeup.notify_one();
+}
+
+const MethodStats &NotificationQueue::stats() const {
+    return mStats;
+}
+
+void NotificationQueue::run() {
+    pthread_setname_np(pthread_self(), "HwNotifications");
+
+    std::unique_lock<std::mutex> lock(mLock);
+
+    while (!mStopping) {
+        const steady_clock::time_point now = steady_clock::now();
+        steady_clock::time_point nextRetry = steady_clock::time_point::max();
+
+        std::vector<Turn> turns;
+        std::vector<std::tuple<const void *, sp<IServiceNotification>, DropReason>> drops;
+        std::vector<const void *> finished;
+
+        for (auto &entry : mListeners) {
+            ListenerState &state = entry.second;
+
+            if (state.drop) {
+                // Kept until mOnDrop returned, see below.
+                if (!state.dropReported) {
+                    state.dropReported = true;
+                    drops.emplace_back(entry.first, state.listener, *state.drop);
+                }
+                continue;
+            }
+            if (state.pending.empty()) {
+                finished.push_back(entry.first);
+                continue;
+            }
+            if (state.retryAt > now) {
+                nextRetry = std::min(nextRetry, state.retryAt);
+                continue;
+            }
+
+            Turn turn{entry.first, state.listener, state.batch, {}};
+            size_t count = std::min(state.pending.size(), kMaxBatch);
+            turn.notifications.assign(state.pending.begin(), state.pending.begin() + count);
+            state.pending.erase(state.pending.begin(), state.pending.begin() + count);
+            turns.push_back(std::move(turn));
+        }
+
+        // Idle listeners are forgotten too, so only listeners with work cost memory.
+        for (const void *identity : finished) {
+            mListeners.erase(identity);
+        }
+
+        if (turns.empty() && drops.empty()) {
+            if (nextRetry == steady_clock::time_point::max()) {
+                mWakeup.wait(lock);
+            } else {
+                mWakeup.wait_until(lock, nextRetry);
+            }
+            continue;
+        }
+
+        lock.unlock();
+
+        for (const auto &drop : drops) {
+            mOnDrop(std::get<1>(drop), std::get<2>(drop));
+        }
+        for (Turn &turn : turns) {
+            deliver(&turn);
+        }
+
+        lock.lock();
+
+        // mOnDrop unsubscribed them, so nothing more is queued for them.
+        for (const auto &drop : drops) {
+            mListeners.erase(std::get<0>(drop));
+        }
+
+        const steady_clock::time_point finishedAt = steady_clock::now();
+        for (const Turn &turn : turns) {
+            finish(turn, finishedAt);
+        }
+    }
+}
+
+void NotificationQueue::deliver(Turn *turn) {
+    if (!turn->batch) {
+        // A transaction for a remote listener, so only asked once.
+        auto batch = IServiceNotificationBatch::castFrom(turn->listener);
+        if (!batch.isOk()) {
+            LOG(ERROR) << "Failed to get the interface of a registration listener: "
+                       << batch.description();
+            turn->outcome = batch.isDeadObject() ? Turn::Outcome::DEAD : Turn::Outcome::FAILED;
+            return;
+        }
+        turn->batch = static_cast<sp<IServiceNotificationBatch>>(batch);
+    }
+
+    if (*turn->batch != nullptr) {
+        deliverBatch(turn);
+        return;
+    }
+
+    for (const Notification &notification : turn->notifications) {
+        const steady_clock::time_point start = steady_clock::now();
+        auto ret = turn->listener->onRegistration(
+            toHidlString(notification.fqName),
+            toHidlString(notification.instanceName),
+            notification.preexisting);
+        const steady_clock::duration elapsed = steady_clock::now() - start;
+
+        mStats.record(kOnRegistration,
+                      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        if (!ret.isOk()) {
+            LOG(ERROR) << "Failed to deliver registration callback for "
+                       << notification.fqName.str() << "/"
+                       << notification.instanceName.str() << ": " << ret.description();
+            turn->outcome = ret.isDeadObject() ? Turn::Outcome::DEAD : Turn::Outcome::FAILED;
+            return;
+        }
+
+        turn->delivered++;
+    }
+}
+
+void NotificationQueue::deliverBatch(Turn *turn) {
+    hidl_vec<Registration> registrations;
+    registrations.resize(turn->notifications.size());
+    for (size_t i = 0; i < turn->notifications.size(); i++) {
+        const Notification &notification = turn->notifications[i];
+        registrations[i].fqName = toHidlString(notification.fqName);
+        registrations[i].instanceName = toHidlString(notification.instanceName);
+        registrations[i].preexisting = notification.preexisting;
+    }
+
+    const steady_clock::time_point start = steady_clock::now();
+    auto ret = (*turn->batch)->onRegistrations(registrations);
+    const steady_clock::duration elapsed = steady_clock::now() - start;
+
+    mStats.record(kOnRegistrations,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+    if (!ret.isOk()) {
+        LOG(ERROR) << "Failed to deliver " << registrations.size()
+                   << " registration callbacks: " << ret.description();
+        turn->outcome = ret.isDeadObject() ? Turn::Outcome::DEAD : Turn::Outcome::FAILED;
+        return;
+    }
+
+    turn->delivered = turn->notifications.size();
+}
+
+void NotificationQueue::finish(const Turn &turn, steady_clock::time_point now) {
+    ListenerState *state = mListeners.find(turn.identity);
+    if (state == nullptr) {
+        // Only this thread erases listeners, and it didn't erase this one.
+        return;
+    }
+
+    if (turn.batch) {
+        state->batch = turn.batch;
+    }
+
+    // Put what wasn't delivered back in front of anything queued meanwhile.
+    state->pending.insert(state->pending.begin(),
+                          turn.notifications.begin() + turn.delivered,
+                          turn.notifications.end());
+
+    switch (turn.outcome) {
+        case Turn::Outcome::DELIVERED:
+            state->strikes = 0;
+            return;
+        case Turn::Outcome::DEAD:
+            state->drop = DropReason::DEAD;
+            return;
+        case Turn::Outcome::FAILED:
+            break;
+    }
+
+    if (++state->strikes >= kMaxStrikes) {
+        LOG(ERROR) << "Quarantining registration listener after " << state->strikes
+                   << " failed turns.";
+        mStats.increment(kQuarantined);
+        state->drop = DropReason::FAILED;
+        return;
+    }
+
+    mStats.increment(kRetried);
+    state->retryAt = now + kInitialBackoff * (1 << (state->strikes - 1));
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
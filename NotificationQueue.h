@@ -0,0 +1,165 @@
+#ifndef ANDROID_HARDWARE_MANAGER_NOTIFICATIONQUEUE_H
+#define ANDROID_HARDWARE_MANAGER_NOTIFICATIONQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <android/hidl/manager/1.1/IServiceManager.h>
+#include <hwservicemanager/ext/1.0/IServiceNotificationBatch.h>
+
+#include "BinderIdentity.h"
+#include "FlatHashMap.h"
+#include "MethodStats.h"
+#include "NamePool.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::manager::V1_0::IServiceNotification;
+using ::android::sp;
+using ::hwservicemanager::ext::V1_0::IServiceNotificationBatch;
+
+/**
+ * Collects onRegistration() calls while the registry is locked and delivers
+ * them from a dedicated thread, so a slow listener never holds up add() or
+ * get().
+ *
+ * Every listener has its own queue and gets its notifications in the order
+ * they were queued. A notification about the same registration as one
+ * still queued for the same listener (e.x. a listener subscribed to both
+ * an instance and its package) is only sent once. Listeners are served
+ * round-robin, at most kMaxBatch notifications per turn. A listener that
+ * implements hwservicemanager.ext@1.0::IServiceNotificationBatch gets its
+ * turn in one onRegistrations() call, any other one onRegistration() call
+ * per notification.
+ *
+ * A listener is quarantined, i.e. gets nothing more and is dropped, when:
+ *   - kMaxPending notifications are waiting for it, or
+ *   - kMaxStrikes turns in a row ended in a transport error, e.x. because
+ *     its async buffer was full. After each strike its turn is retried
+ *     after a backoff starting at kInitialBackoff and doubling every time.
+ * A listener whose process died is dropped right away. A dropped listener
+ * isn't forgotten until DropCallback returned, so it can't be revived by
+ * a notification queued meanwhile.
+ */
+class NotificationQueue {
+public:
+    static constexpr size_t kMaxPending = 256;
+    static constexpr size_t kMaxBatch = 16;
+    static constexpr uint32_t kMaxStrikes = 5;
+    static constexpr std::chrono::milliseconds kInitialBackoff{10};
+
+    enum class DropReason {
+        DEAD,       // the listener's process died
+        FAILED,     // too many failed calls
+        QUEUE_FULL, // too many notifications waiting
+    };
+
+    /**
+     * Called on the delivery thread, without any lock held, for a listener
+     * that was dropped. Nothing more is delivered to it.
+     */
+    using DropCallback = std::function<void(const sp<IServiceNotification> &listener,
+                                            DropReason reason)>;
+
+    explicit NotificationQueue(DropCallback onDrop);
+    ~NotificationQueue();
+
+    /**
+     * registration tells apart the registrations of fqName/instanceName,
+     * see HidlService::getRegistration().
+     */
+    void enqueue(const sp<IServiceNotification> &listener,
+                 InternedName fqName,
+                 InternedName instanceName,
+                 uint64_t registration,
+                 bool preexisting);
+
+    /**
+     * Wakes the delivery thread up for everything queued so far. Never
+     * blocks on a listener.
+     */
+    void flush();
+
+    /**
+     * onRegistration() and onRegistrations() latency, plus counts of retried
+     * turns, overflows and quarantined listeners.
+     */
+    const MethodStats &stats() const;
+
+private:
+    enum Method : size_t {
+        kOnRegistration,
+        kOnRegistrations,
+    };
+    enum Counter : size_t {
+        kRetried,
+        kOverflow,
+        kQuarantined,
+    };
+
+    struct Notification {
+        InternedName fqName;
+        InternedName instanceName;
+        uint64_t registration;
+        bool preexisting;
+    };
+
+    // listener as an IServiceNotificationBatch (nullptr if it isn't one),
+    // once a turn found out.
+    using BatchListener = std::optional<sp<IServiceNotificationBatch>>;
+
+    struct ListenerState {
+        sp<IServiceNotification> listener;
+        BatchListener batch;
+        std::deque<Notification> pending;
+        uint32_t strikes = 0;
+        std::chrono::steady_clock::time_point retryAt;
+        std::optional<DropReason> drop; // set once quarantined
+        bool dropReported = false;      // DropCallback is running for it
+    };
+
+    // One listener's turn, taken out of its queue for the delivery thread.
+    struct Turn {
+        enum class Outcome { DELIVERED, FAILED, DEAD };
+
+        const void *identity; // identityOf(listener)
+        sp<IServiceNotification> listener;
+        BatchListener batch;
+        std::vector<Notification> notifications;
+        size_t delivered = 0;
+        Outcome outcome = Outcome::DELIVERED;
+    };
+
+    void run();
+    void deliver(Turn *turn);
+    void deliverBatch(Turn *turn); // for a listener that is an IServiceNotificationBatch
+    void finish(const Turn &turn, std::chrono::steady_clock::time_point now); // requires mLock
+
+    const DropCallback mOnDrop;
+    MethodStats mStats;
+
+    std::mutex mLock; // guards the members below
+    std::condition_variable mWakeup;
+    // Keyed by identityOf(); each state, or a Turn while it's out, holds
+    // the listener and so keeps its key valid.
+    FlatHashMap<const void *, ListenerState, PointerHash> mListeners;
+    bool mStopping = false;
+
+    std::thread mThread; // started last
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_NOTIFICATIONQUEUE_H
@@ -0,0 +1,96 @@
+#include "PassthroughClients.h"
+
+#include <algorithm>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+uint64_t PassthroughClients::processStartTime(pid_t pid) {
+    std::string stat;
+    if (!android::base::ReadFileToString("/proc/" + std::to_string(pid) + "/stat", &stat)) {
+        return 0;
+    }
+
+    // "pid (comm) state ppid ..."; comm may contain spaces and parentheses,
+    // so count fields from the last ')'. starttime is field 22, i.e. the
+    // 20th field after comm.
+    size_t commEnd = stat.rfind(')');
+    if (commEnd == std::string::npos) {
+        return 0;
+    }
+    std::vector<std::string> fields = android::base::Split(stat.substr(commEnd + 2), " ");
+    if (fields.size() < 20) {
+        return 0;
+    }
+
+    uint64_t startTime;
+    if (!android::base::ParseUint(fields[19], &startTime)) {
+        return 0;
+    }
+    return startTime;
+}
+
+bool PassthroughClients::isAlive(const Client &client) {
+    return processStartTime(client.pid) == client.startTime;
+}
+
+void PassthroughClients::add(pid_t pid, uint64_t startTime) {
+    if (startTime == 0) {
+        return;
+    }
+
+    auto it = std::find_if(mClients.begin(), mClients.end(),
+                           [&](const Client &client) { return client.pid == pid; });
+    if (it != mClients.end()) {
+        // Same process again, or a new process that reused the pid.
+        it->startTime = startTime;
+        return;
+    }
+
+    if (mClients.size() >= kMaxClients) {
+        mClients.erase(mClients.begin());
+    }
+
+    mClients.push_back({pid, startTime});
+}
+
+std::vector<pid_t> PassthroughClients::live(std::vector<Client> *dead) const {
+    std::vector<pid_t> pids;
+    pids.reserve(mClients.size());
+    for (const Client &client : mClients) {
+        if (isAlive(client)) {
+            pids.push_back(client.pid);
+        } else if (dead != nullptr) {
+            dead->push_back(client);
+        }
+    }
+    return pids;
+}
+
+void PassthroughClients::remove(const std::vector<Client> &clients) {
+    mClients.erase(std::remove_if(mClients.begin(), mClients.end(),
+                                  [&](const Client &client) {
+                                      return std::any_of(clients.begin(), clients.end(),
+                                                         [&](const Client &removed) {
+                                          return removed.pid == client.pid &&
+                                                 removed.startTime == client.startTime;
+                                      });
+                                  }),
+                   mClients.end());
+}
+
+size_t PassthroughClients::size() const {
+    return mClients.size();
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
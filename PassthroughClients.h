@@ -0,0 +1,66 @@
+#ifndef ANDROID_HARDWARE_MANAGER_PASSTHROUGHCLIENTS_H
+#define ANDROID_HARDWARE_MANAGER_PASSTHROUGHCLIENTS_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+/**
+ * The processes that opened a passthrough service, at most kMaxClients
+ * of them.
+ *
+ * Each pid is stamped with its process start time, so a pid that was
+ * reused by another process isn't mistaken for the original client.
+ * Nothing here reads /proc but processStartTime() and live(), so the
+ * owner can do both without holding its lock: read the start time before
+ * add(), and call live() on a copy, then remove() the dead clients it
+ * found.
+ */
+class PassthroughClients {
+public:
+    static constexpr size_t kMaxClients = 32;
+
+    // Returns 0 if pid doesn't exist (anymore).
+    static uint64_t processStartTime(pid_t pid);
+
+    struct Client {
+        pid_t pid;
+        uint64_t startTime;
+    };
+
+    /**
+     * Records pid, started at startTime (see processStartTime()), as a
+     * client. Does nothing if startTime is 0. When full, drops the client
+     * recorded longest ago.
+     */
+    void add(pid_t pid, uint64_t startTime);
+
+    /**
+     * Clients still running, in the order they were first recorded. The
+     * others are appended to dead if given.
+     */
+    std::vector<pid_t> live(std::vector<Client> *dead = nullptr) const;
+
+    // Drops clients, unless their pid was recorded again since.
+    void remove(const std::vector<Client> &clients);
+
+    size_t size() const;
+
+private:
+    static bool isAlive(const Client &client);
+
+    std::vector<Client> mClients;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_PASSTHROUGHCLIENTS_H
@@ -0,0 +1,70 @@
+#include "RegistrationIndex.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+template <typename Key, typename Hash>
+static void removeEntry(FlatHashMap<Key, std::vector<HidlService *>, Hash> *map,
+                        const Key &key, HidlService *entry) {
+    std::vector<HidlService *> *entries = map->find(key);
+    if (entries == nullptr) {
+        return;
+    }
+
+    auto it = std::find(entries->begin(), entries->end(), entry);
+    if (it != entries->end()) {
+        *it = entries->back();
+        entries->pop_back();
+    }
+
+    if (entries->empty()) {
+        map->erase(key);
+    }
+}
+
+void RegistrationIndex::add(HidlService *entry) {
+    sp<IBase> service = entry->getService();
+    if (service == nullptr) {
+        return;
+    }
+
+    mByIdentity[identityOf(service)].push_back(entry);
+
+    pid_t pid = entry->getDebugPid();
+    if (pid != static_cast<pid_t>(IServiceManager::PidConstant::NO_PID)) {
+        mByPid[pid].push_back(entry);
+    }
+}
+
+void RegistrationIndex::remove(HidlService *entry) {
+    sp<IBase> service = entry->getService();
+    if (service == nullptr) {
+        return;
+    }
+
+    removeEntry(&mByIdentity, identityOf(service), entry);
+    removeEntry(&mByPid, entry->getDebugPid(), entry);
+}
+
+std::vector<HidlService *> RegistrationIndex::findByService(const sp<IBase> &service) const {
+    if (service == nullptr) {
+        return {};
+    }
+
+    const std::vector<HidlService *> *entries = mByIdentity.find(identityOf(service));
+    return entries == nullptr ? std::vector<HidlService *>() : *entries;
+}
+
+std::vector<HidlService *> RegistrationIndex::findByPid(pid_t pid) const {
+    const std::vector<HidlService *> *entries = mByPid.find(pid);
+    return entries == nullptr ? std::vector<HidlService *>() : *entries;
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
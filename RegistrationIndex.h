@@ -0,0 +1,60 @@
+#ifndef ANDROID_HARDWARE_MANAGER_REGISTRATIONINDEX_H
+#define ANDROID_HARDWARE_MANAGER_REGISTRATIONINDEX_H
+
+#include <vector>
+
+#include "BinderIdentity.h"
+#include "FlatHashMap.h"
+#include "HidlService.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+/**
+ * Reverse index from the service behind a registration (by identityOf()),
+ * and from the pid hosting it, to the HidlService entries it backs. One add()
+ * registers a service under every interface in its chain, so a service
+ * usually maps to several entries.
+ *
+ * Entries are indexed by their current service and pid, so ServiceManager
+ * has to remove() an entry before changing its service and add() it back
+ * afterwards.
+ */
+class RegistrationIndex {
+public:
+    /**
+     * Records entry under its current service and pid. Entries without a
+     * service aren't indexed.
+     */
+    void add(HidlService *entry);
+
+    /**
+     * Forgets the registration add() recorded for entry.
+     */
+    void remove(HidlService *entry);
+
+    /**
+     * Entries currently backed by service, compared the way interfacesEqual()
+     * compares them.
+     */
+    std::vector<HidlService *> findByService(const sp<IBase> &service) const;
+
+    /**
+     * Entries currently registered by pid.
+     */
+    std::vector<HidlService *> findByPid(pid_t pid) const;
+
+private:
+    // The entries hold their services, which keeps the keys valid.
+    FlatHashMap<const void *, std::vector<HidlService *>, PointerHash> mByIdentity;
+    FlatHashMap<pid_t, std::vector<HidlService *>> mByPid;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_REGISTRATIONINDEX_H
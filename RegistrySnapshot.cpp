@@ -0,0 +1,176 @@
+#include "RegistrySnapshot.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+std::string RegistrySnapshot::Entry::joined() const {
+    std::string entry;
+    entry.reserve(fqName.size() + 1 + name.size());
+    return entry.append(fqName).append("/").append(name);
+}
+
+int RegistrySnapshot::Entry::compare(std::string_view other) const {
+    const size_t n = std::min(fqName.size(), other.size());
+    if (int result = fqName.substr(0, n).compare(other.substr(0, n)); result != 0) {
+        return result;
+    }
+    if (other.size() <= fqName.size()) {
+        return 1;  // other is fqName, or a prefix of it
+    }
+    const unsigned char next = other[fqName.size()];
+    if (next != '/') {
+        return '/' < next ? -1 : 1;
+    }
+    return name.compare(other.substr(fqName.size() + 1));
+}
+
+bool RegistrySnapshot::Entry::startsWith(std::string_view prefix) const {
+    if (prefix.size() <= fqName.size()) {
+        return fqName.substr(0, prefix.size()) == prefix;
+    }
+    return prefix.substr(0, fqName.size()) == fqName && prefix[fqName.size()] == '/' &&
+            name.substr(0, prefix.size() - fqName.size() - 1) ==
+                    prefix.substr(fqName.size() + 1);
+}
+
+bool RegistrySnapshot::Entry::operator<(const Entry &other) const {
+    if (fqName == other.fqName) {
+        return name < other.name;
+    }
+    const size_t n = std::min(fqName.size(), other.fqName.size());
+    if (int result = fqName.substr(0, n).compare(other.fqName.substr(0, n)); result != 0) {
+        return result < 0;
+    }
+    // One fqName is a prefix of the other; the shorter one goes on with '/'.
+    const unsigned char next = fqName.size() < other.fqName.size() ? other.fqName[n] : fqName[n];
+    if (next == '/') {
+        return compare(other.joined()) < 0;  // never for valid fqNames
+    }
+    return (fqName.size() < other.fqName.size()) == ('/' < next);
+}
+
+sp<IBase> RegistrySnapshot::lookup(std::string_view fqName, std::string_view name) const {
+    const InstanceMap *instanceMap = lookupInterface(fqName);
+    if (instanceMap == nullptr) {
+        return nullptr;
+    }
+
+    const sp<IBase> *service = instanceMap->find(name);
+    return service == nullptr ? nullptr : *service;
+}
+
+const RegistrySnapshot::InstanceMap *RegistrySnapshot::lookupInterface(
+        std::string_view fqName) const {
+    const std::shared_ptr<const InstanceMap> *instanceMap = mInterfaces.find(fqName);
+    return instanceMap == nullptr ? nullptr : instanceMap->get();
+}
+
+size_t RegistrySnapshot::size() const {
+    return mSize;
+}
+
+const RegistrySnapshot::SortedEntries &RegistrySnapshot::sortedEntries() const {
+    return *mSorted;
+}
+
+RegistrySnapshot::SortedEntries::const_iterator RegistrySnapshot::lowerBound(
+        std::string_view key) const {
+    return std::partition_point(mSorted->begin(), mSorted->end(),
+                                [&](const Entry &entry) { return entry.compare(key) < 0; });
+}
+
+RegistrySnapshot::SortedEntries::const_iterator RegistrySnapshot::upperBound(
+        std::string_view key) const {
+    return std::partition_point(mSorted->begin(), mSorted->end(),
+                                [&](const Entry &entry) { return entry.compare(key) <= 0; });
+}
+
+SnapshotPublisher::SnapshotPublisher()
+    : mCurrent(std::make_shared<const RegistrySnapshot>()) {}
+
+std::shared_ptr<const RegistrySnapshot> SnapshotPublisher::current() const {
+    return std::atomic_load(&mCurrent);
+}
+
+void SnapshotPublisher::stage(InternedName fqName, InternedName name,
+                              const sp<IBase> &service) {
+    mStaged.push_back({fqName, name, service});
+}
+
+void SnapshotPublisher::publish() {
+    if (mStaged.empty()) {
+        return;
+    }
+
+    // Only the publisher replaces mCurrent, so it can be read without atomics here.
+    auto next = std::make_shared<RegistrySnapshot>(*mCurrent);
+
+    // Instance maps copied by this publish(), which can be modified in place.
+    FlatHashMap<std::string_view, std::shared_ptr<RegistrySnapshot::InstanceMap>,
+                StringViewHash> copied;
+
+    // Copied on the first service added or removed, replacements keep the order.
+    std::shared_ptr<RegistrySnapshot::SortedEntries> sorted;
+    auto sortedForWrite = [&]() -> RegistrySnapshot::SortedEntries & {
+        if (sorted == nullptr) {
+            sorted = std::make_shared<RegistrySnapshot::SortedEntries>(*next->mSorted);
+        }
+        return *sorted;
+    };
+
+    for (const Change &change : mStaged) {
+        std::shared_ptr<RegistrySnapshot::InstanceMap> *instanceMap = copied.find(change.fqName.view());
+        if (instanceMap == nullptr) {
+            const std::shared_ptr<const RegistrySnapshot::InstanceMap> *old =
+                    next->mInterfaces.find(change.fqName.view());
+            instanceMap = copied.insert(change.fqName.view(),
+                    old == nullptr ? std::make_shared<RegistrySnapshot::InstanceMap>()
+                                   : std::make_shared<RegistrySnapshot::InstanceMap>(**old))
+                    .first;
+        }
+
+        RegistrySnapshot::InstanceMap &instances = **instanceMap;
+        const RegistrySnapshot::Entry entry = {change.fqName.view(), change.name.view()};
+        if (change.service == nullptr) {
+            if (instances.erase(change.name.view())) {
+                --next->mSize;
+                RegistrySnapshot::SortedEntries &entries = sortedForWrite();
+                entries.erase(std::lower_bound(entries.begin(), entries.end(), entry));
+            }
+        } else {
+            auto inserted = instances.insert(change.name.view(), change.service);
+            if (inserted.second) {
+                ++next->mSize;
+                RegistrySnapshot::SortedEntries &entries = sortedForWrite();
+                entries.insert(std::lower_bound(entries.begin(), entries.end(), entry), entry);
+            } else {
+                *inserted.first = change.service;
+            }
+        }
+    }
+    mStaged.clear();
+
+    for (auto &interfaceMapping : copied) {
+        if (interfaceMapping.second->empty()) {
+            next->mInterfaces.erase(interfaceMapping.first);
+        } else {
+            next->mInterfaces[interfaceMapping.first] = std::move(interfaceMapping.second);
+        }
+    }
+
+    if (sorted != nullptr) {
+        next->mSorted = std::move(sorted);
+    }
+
+    std::atomic_store(&mCurrent, std::shared_ptr<const RegistrySnapshot>(std::move(next)));
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
@@ -0,0 +1,157 @@
+#ifndef ANDROID_HARDWARE_MANAGER_REGISTRYSNAPSHOT_H
+#define ANDROID_HARDWARE_MANAGER_REGISTRYSNAPSHOT_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android/hidl/manager/1.1/IServiceManager.h>
+
+#include "FlatHashMap.h"
+#include "NamePool.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::base::V1_0::IBase;
+using ::android::sp;
+
+/**
+ * Immutable view of the services registered at some point in time.
+ *
+ * Readers get one from SnapshotPublisher::current() and can use it from any
+ * thread without locking. Only entries with a service are included. Names
+ * are views into the NamePool of the ServiceManager that published the
+ * snapshot.
+ */
+class RegistrySnapshot {
+public:
+    using InstanceMap = FlatHashMap<
+        std::string_view, // instance name e.x. "manager"
+        sp<IBase>,
+        StringViewHash
+    >;
+
+    /**
+     * A registered service's names, ordered by their "fqName/name" string
+     * without building it.
+     */
+    struct Entry {
+        std::string_view fqName;
+        std::string_view name;
+
+        // "fqName/name"
+        std::string joined() const;
+
+        // <0, 0 or >0 as "fqName/name" sorts before, as or after other.
+        int compare(std::string_view other) const;
+
+        // Whether "fqName/name" starts with prefix.
+        bool startsWith(std::string_view prefix) const;
+
+        bool operator<(const Entry &other) const;
+    };
+    using SortedEntries = std::vector<Entry>;
+
+    RegistrySnapshot() = default;
+    RegistrySnapshot(const RegistrySnapshot &other) = default;
+    RegistrySnapshot &operator=(const RegistrySnapshot &) = delete;
+
+    /**
+     * Returns the service registered as fqName/name, or nullptr.
+     */
+    sp<IBase> lookup(std::string_view fqName, std::string_view name) const;
+
+    /**
+     * Returns the services registered for fqName, or nullptr if there are none.
+     */
+    const InstanceMap *lookupInterface(std::string_view fqName) const;
+
+    // number of fqName/instance pairs with a service
+    size_t size() const;
+
+    /**
+     * Every registered service, sorted. Shared with the snapshots before
+     * and after this one as long as no service is added or removed, so
+     * ordered reads never wait for mLock or copy names.
+     */
+    const SortedEntries &sortedEntries() const;
+
+    // First entry in sortedEntries() sorting as or after key.
+    SortedEntries::const_iterator lowerBound(std::string_view key) const;
+
+    // First entry in sortedEntries() sorting after key.
+    SortedEntries::const_iterator upperBound(std::string_view key) const;
+
+    /**
+     * Calls f(fqName, name, service) for every registered service.
+     */
+    template <typename F>
+    void forEach(F f) const {
+        for (const auto &interfaceMapping : mInterfaces) {
+            for (const auto &instanceMapping : *interfaceMapping.second) {
+                f(interfaceMapping.first, instanceMapping.first, instanceMapping.second);
+            }
+        }
+    }
+
+private:
+    friend class SnapshotPublisher;
+
+    // Instance maps are shared between consecutive snapshots and only
+    // copied when one of their instances changes.
+    FlatHashMap<
+        std::string_view, // package::interface e.x. "android.hidl.manager@1.0::IServiceManager"
+        std::shared_ptr<const InstanceMap>,
+        StringViewHash
+    > mInterfaces;
+    size_t mSize = 0;
+
+    std::shared_ptr<const SortedEntries> mSorted = std::make_shared<const SortedEntries>();
+};
+
+/**
+ * Builds and publishes RegistrySnapshots with copy-on-write.
+ *
+ * current() may be called from any thread. stage() and publish() must be
+ * serialized by the caller.
+ */
+class SnapshotPublisher {
+public:
+    SnapshotPublisher();
+
+    std::shared_ptr<const RegistrySnapshot> current() const;
+
+    /**
+     * Records that fqName/name is now served by service (nullptr if it
+     * isn't served anymore). Not visible to readers until publish().
+     */
+    void stage(InternedName fqName, InternedName name, const sp<IBase> &service);
+
+    /**
+     * Atomically replaces the current snapshot with one that includes
+     * every staged change. Only the instance maps of changed interfaces
+     * are copied, and the sorted entries only if services came or went.
+     */
+    void publish();
+
+private:
+    struct Change {
+        InternedName fqName;
+        InternedName name;
+        sp<IBase> service;
+    };
+
+    std::shared_ptr<const RegistrySnapshot> mCurrent; // accessed with std::atomic_load/store
+    std::vector<Change> mStaged;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_MANAGER_REGISTRYSNAPSHOT_H
@@ -3,58 +3,44 @@
 #include "ServiceManager.h"
 #include "Vintf.h"
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
-#include <hwbinder/IPCThreadState.h>
+#include <android-base/parseint.h>
 #include <hidl/HidlSupport.h>
 #include <hidl/HidlTransportSupport.h>
+#include <algorithm>
+#include <chrono>
 #include <regex>
 #include <sstream>
-
-using android::hardware::IPCThreadState;
+#include <unistd.h>
 
 namespace android {
 namespace hidl {
 namespace manager {
 namespace implementation {
 
-AccessControl::CallingContext getBinderCallingContext() {
-    const auto& self = IPCThreadState::self();
-
-    pid_t pid = self->getCallingPid();
-    const char* sid = self->getCallingSid();
-
-    if (sid == nullptr) {
-        if (pid != getpid()) {
-            android_errorWriteLog(0x534e4554, "121035042");
-        }
-
-        return AccessControl::getCallingContext(pid);
-    } else {
-        return { true, sid, pid };
-    }
+ServiceManager::ServiceManager(std::unique_ptr<AccessControlBackend> acl, size_t maxWaiters)
+    : mAcl(std::move(acl)),
+      mStats({"get", "add", "getTransport", "list", "listByInterface",
+              "registerForNotifications", "unregisterForNotifications",
+              "registerPassthroughClient", "getServices", "waitForService", "listPage",
+              "getGeneration", "getChangesSince", "debugDump"},
+             {"acl_denied", "lookup_miss", "dropped_callback", "wait_timed_out",
+              "duplicate_listener", "name_pool_full"}),
+      mNotifications([this](const sp<IServiceNotification>& listener,
+                            NotificationQueue::DropReason reason) {
+          onNotificationDropped(listener, reason);
+      }),
+      mMaxWaiters(maxWaiters) {}
+
+void ServiceManager::setRecorder(std::shared_ptr<CallRecorder> recorder) {
+    mRecorder = std::move(recorder);
 }
 
 static constexpr uint64_t kServiceDiedCookie = 0;
 static constexpr uint64_t kPackageListenerDiedCookie = 1;
 static constexpr uint64_t kServiceListenerDiedCookie = 2;
 
-size_t ServiceManager::countExistingService() const {
-    size_t total = 0;
-    forEachExistingService([&] (const HidlService *) {
-        ++total;
-    });
-    return total;
-}
-
-void ServiceManager::forEachExistingService(std::function<void(const HidlService *)> f) const {
-    forEachServiceEntry([f] (const HidlService *service) {
-        if (service->getService() == nullptr) {
-            return;
-        }
-        f(service);
-    });
-}
-
 void ServiceManager::forEachServiceEntry(std::function<void(const HidlService *)> f) const {
     for (const auto &interfaceMapping : mServiceMap) {
         const auto &instanceMap = interfaceMapping.second.getInstanceMap();
@@ -66,19 +52,38 @@ void ServiceManager::forEachServiceEntry(std::function<void(const HidlService *)
 }
 
 void ServiceManager::serviceDied(uint64_t cookie, const wp<IBase>& who) {
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::SERVICE_DIED);
+    call.setBinder(identityOf(who.promote()));
+    call.setArg(cookie);
+
+    std::lock_guard<std::mutex> lock(mLock);
+
     switch (cookie) {
         case kServiceDiedCookie:
             removeService(who);
             break;
         case kPackageListenerDiedCookie:
-            removePackageListener(who);
-            break;
         case kServiceListenerDiedCookie:
-            removeServiceListener(who);
+            removeListener(who.promote());
             break;
     }
 }
 
+void ServiceManager::onNotificationDropped(const sp<IServiceNotification>& listener,
+                                           NotificationQueue::DropReason reason) {
+    mStats.increment(kDroppedCallback);
+
+    if (reason != NotificationQueue::DropReason::DEAD) {
+        LOG(WARNING) << "Unsubscribing a registration listener that "
+                     << (reason == NotificationQueue::DropReason::QUEUE_FULL
+                             ? "fell too far behind." : "kept failing.");
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    removeListener(listener);
+}
+
 ServiceManager::InstanceMap &ServiceManager::PackageInterfaceMap::getInstanceMap() {
     return mInstanceMap;
 }
@@ -88,45 +93,49 @@ const ServiceManager::InstanceMap &ServiceManager::PackageInterfaceMap::getInsta
 }
 
 const HidlService *ServiceManager::PackageInterfaceMap::lookup(
-        const std::string &name) const {
-    auto it = mInstanceMap.find(name);
+        InternedName name) const {
+    const std::unique_ptr<HidlService> *service = mInstanceMap.find(name);
 
-    if (it == mInstanceMap.end()) {
+    if (service == nullptr) {
         return nullptr;
     }
 
-    return it->second.get();
+    return service->get();
 }
 
 HidlService *ServiceManager::PackageInterfaceMap::lookup(
-        const std::string &name) {
+        InternedName name) {
 
     return const_cast<HidlService*>(
         const_cast<const PackageInterfaceMap*>(this)->lookup(name));
 }
 
-void ServiceManager::PackageInterfaceMap::insertService(
+HidlService *ServiceManager::PackageInterfaceMap::insertService(
         std::unique_ptr<HidlService> &&service) {
-    mInstanceMap.insert({service->getInstanceName(), std::move(service)});
+    InternedName instanceName = service->getInternedInstanceName();
+    return mInstanceMap.insert(instanceName, std::move(service)).first->get();
 }
 
 void ServiceManager::PackageInterfaceMap::sendPackageRegistrationNotification(
-        const hidl_string &fqName,
-        const hidl_string &instanceName) {
+        const HidlService &service,
+        NotificationQueue &notifications) const {
 
-    for (auto it = mPackageListeners.begin(); it != mPackageListeners.end();) {
-        auto ret = (*it)->onRegistration(fqName, instanceName, false /* preexisting */);
-        if (ret.isOk()) {
-            ++it;
-        } else {
-            LOG(ERROR) << "Dropping registration callback for " << fqName << "/" << instanceName
-                       << ": transport error.";
-            it = mPackageListeners.erase(it);
-        }
+    for (const auto &listener : mPackageListeners) {
+        notifications.enqueue(listener.second,
+                              service.getInternedInterfaceName(),
+                              service.getInternedInstanceName(),
+                              service.getRegistration(),
+                              false /* preexisting */);
     }
 }
 
-void ServiceManager::PackageInterfaceMap::addPackageListener(sp<IServiceNotification> listener) {
+bool ServiceManager::PackageInterfaceMap::addPackageListener(
+        sp<IServiceNotification> listener,
+        NotificationQueue &notifications) {
+    if (!mPackageListeners.insert(identityOf(listener), listener).second) {
+        return false;
+    }
+
     for (const auto &instanceMapping : mInstanceMap) {
         const std::unique_ptr<HidlService> &service = instanceMapping.second;
 
@@ -134,117 +143,134 @@ void ServiceManager::PackageInterfaceMap::addPackageListener(sp<IServiceNotifica
             continue;
         }
 
-        auto ret = listener->onRegistration(
-            service->getInterfaceName(),
-            service->getInstanceName(),
-            true /* preexisting */);
-        if (!ret.isOk()) {
-            LOG(ERROR) << "Not adding package listener for " << service->getInterfaceName()
-                       << "/" << service->getInstanceName() << ": transport error "
-                       << "when sending notification for already registered instance.";
-            return;
-        }
+        notifications.enqueue(listener,
+                              service->getInternedInterfaceName(),
+                              service->getInternedInstanceName(),
+                              service->getRegistration(),
+                              true /* preexisting */);
     }
-    mPackageListeners.push_back(listener);
-}
-
-bool ServiceManager::PackageInterfaceMap::removePackageListener(const wp<IBase>& who) {
-    using ::android::hardware::interfacesEqual;
-
-    bool found = false;
-
-    for (auto it = mPackageListeners.begin(); it != mPackageListeners.end();) {
-        if (interfacesEqual(*it, who.promote())) {
-            it = mPackageListeners.erase(it);
-            found = true;
-        } else {
-            ++it;
-        }
-    }
-
-    return found;
+    return true;
 }
 
-bool ServiceManager::PackageInterfaceMap::removeServiceListener(const wp<IBase>& who) {
-    using ::android::hardware::interfacesEqual;
-
-    bool found = false;
-
-    for (auto &servicePair : getInstanceMap()) {
-        const std::unique_ptr<HidlService> &service = servicePair.second;
-        found |= service->removeListener(who);
-    }
-
-    return found;
+bool ServiceManager::PackageInterfaceMap::removePackageListener(const sp<IBase>& listener) {
+    return mPackageListeners.erase(identityOf(listener));
 }
 
 // Methods from ::android::hidl::manager::V1_0::IServiceManager follow.
 Return<sp<IBase>> ServiceManager::get(const hidl_string& fqName,
                                       const hidl_string& name) {
-    if (!mAcl.canGet(fqName, getBinderCallingContext())) {
-        return nullptr;
-    }
+    auto timer = mStats.time(kGet);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET,
+                            toStringView(fqName), toStringView(name));
 
-    auto ifaceIt = mServiceMap.find(fqName);
-    if (ifaceIt == mServiceMap.end()) {
+    if (!mAcl->canGet(toStringView(fqName), mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         return nullptr;
     }
 
-    const PackageInterfaceMap &ifaceMap = ifaceIt->second;
-    const HidlService *hidlService = ifaceMap.lookup(name);
-
-    if (hidlService == nullptr) {
-        return nullptr;
+    sp<IBase> service = mSnapshot.current()->lookup(toStringView(fqName), toStringView(name));
+    if (service == nullptr) {
+        mStats.increment(kLookupMiss);
     }
-
-    return hidlService->getService();
+    call.setResult(service != nullptr);
+    return service;
 }
 
 Return<bool> ServiceManager::add(const hidl_string& name, const sp<IBase>& service) {
+    auto timer = mStats.time(kAdd);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::ADD,
+                            std::string_view(), toStringView(name));
     bool isValidService = false;
 
     if (service == nullptr) {
         return false;
     }
+    call.setBinder(identityOf(service));
 
-    auto callingContext = getBinderCallingContext();
+    auto callingContext = mAcl->getCallingContext();
 
     auto ret = service->interfaceChain([&](const auto &interfaceChain) {
         if (interfaceChain.size() == 0) {
             return;
         }
 
+        if (mRecorder != nullptr) {
+            std::string chain;
+            for (size_t i = 0; i < interfaceChain.size(); i++) {
+                chain.append(i == 0 ? "" : ",").append(toStringView(interfaceChain[i]));
+            }
+            call.setFqName(chain);
+        }
+
         // First, verify you're allowed to add() the whole interface hierarchy
         for(size_t i = 0; i < interfaceChain.size(); i++) {
-            std::string fqName = interfaceChain[i];
-
-            if (!mAcl.canAdd(fqName, callingContext)) {
+            if (!mAcl->canAdd(toStringView(interfaceChain[i]), callingContext)) {
+                mStats.increment(kAclDenied);
+                call.setDenied();
                 return;
             }
         }
 
-        for(size_t i = 0; i < interfaceChain.size(); i++) {
-            std::string fqName = interfaceChain[i];
+        std::lock_guard<std::mutex> lock(mLock);
+
+        // Interned up front, so a full mNames leaves the registry untouched.
+        InternedName instanceName = mNames.intern(toStringView(name));
+        bool interned = static_cast<bool>(instanceName);
+        std::vector<InternedName> interfaceNames;
+        for (size_t i = 0; interned && i < interfaceChain.size(); i++) {
+            interfaceNames.push_back(mNames.intern(toStringView(interfaceChain[i])));
+            interned = static_cast<bool>(interfaceNames.back());
+        }
+        if (!interned) {
+            mStats.increment(kNamePoolFull);
+            LOG(ERROR) << "Too many names registered, cannot add " << name << ".";
+            return;
+        }
 
-            PackageInterfaceMap &ifaceMap = mServiceMap[fqName];
-            HidlService *hidlService = ifaceMap.lookup(name);
+        // A binder is linked to death once, however many entries it backs.
+        const bool linked = !mRegistrations.findByService(service).empty();
+        std::vector<sp<IBase>> replaced;
+
+        for(size_t i = 0; i < interfaceChain.size(); i++) {
+            InternedName interfaceName = interfaceNames[i];
+            PackageInterfaceMap &ifaceMap = mServiceMap[interfaceName];
+            HidlService *hidlService = ifaceMap.lookup(instanceName);
 
             if (hidlService == nullptr) {
-                ifaceMap.insertService(
-                    std::make_unique<HidlService>(fqName, name, service, callingContext.pid));
-            } else {
-                if (hidlService->getService() != nullptr) {
-                    auto ret = hidlService->getService()->unlinkToDeath(this);
-                    ret.isOk(); // ignore
-                }
-                hidlService->setService(service, callingContext.pid);
+                hidlService = ifaceMap.insertService(
+                    std::make_unique<HidlService>(interfaceName, instanceName));
+            } else if (hidlService->getService() != nullptr) {
+                replaced.push_back(hidlService->getService());
             }
+            setService(hidlService, service, callingContext.pid);
+        }
 
-            ifaceMap.sendPackageRegistrationNotification(fqName, name);
+        // A replaced service may still back other entries, e.x. its own
+        // android.hidl.base@1.0::IBase one; it must hear about its death for those.
+        for (const sp<IBase> &previous : replaced) {
+            if (mRegistrations.findByService(previous).empty()) {
+                auto ret = previous->unlinkToDeath(this);
+                ret.isOk(); // ignore
+            }
         }
 
-        auto linkRet = service->linkToDeath(this, 0 /*cookie*/);
-        linkRet.isOk(); // ignore
+        // A listener may call get() as soon as it is notified, so publish first.
+        mSnapshot.publish();
+        mServiceAdded.notify_all();
+
+        for(size_t i = 0; i < interfaceChain.size(); i++) {
+            PackageInterfaceMap &ifaceMap = *mServiceMap.find(interfaceNames[i]);
+
+            const HidlService *entry = ifaceMap.lookup(instanceName);
+            entry->sendRegistrationNotifications(mNotifications);
+            ifaceMap.sendPackageRegistrationNotification(*entry, mNotifications);
+        }
+
+        if (!linked) {
+            auto linkRet = service->linkToDeath(this, kServiceDiedCookie);
+            linkRet.isOk(); // ignore
+        }
 
         isValidService = true;
     });
@@ -254,6 +280,9 @@ Return<bool> ServiceManager::add(const hidl_string& name, const sp<IBase>& servi
         return false;
     }
 
+    mNotifications.flush();
+
+    call.setResult(isValidService);
     return isValidService;
 }
 
@@ -261,74 +290,93 @@ Return<ServiceManager::Transport> ServiceManager::getTransport(const hidl_string
                                                                const hidl_string& name) {
     using ::android::hardware::getTransport;
 
-    if (!mAcl.canGet(fqName, getBinderCallingContext())) {
+    auto timer = mStats.time(kGetTransport);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET_TRANSPORT,
+                            toStringView(fqName), toStringView(name));
+
+    if (!mAcl->canGet(toStringView(fqName), mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         return Transport::EMPTY;
     }
 
-    switch (getTransport(fqName, name)) {
+    Transport transport;
+    switch (getTransport(toStringView(fqName), toStringView(name))) {
         case vintf::Transport::HWBINDER:
-             return Transport::HWBINDER;
+             transport = Transport::HWBINDER;
+             break;
         case vintf::Transport::PASSTHROUGH:
-             return Transport::PASSTHROUGH;
+             transport = Transport::PASSTHROUGH;
+             break;
         case vintf::Transport::EMPTY:
         default:
-             return Transport::EMPTY;
+             transport = Transport::EMPTY;
+             break;
     }
+    call.setResult(static_cast<uint8_t>(transport));
+    return transport;
 }
 
 Return<void> ServiceManager::list(list_cb _hidl_cb) {
-    if (!mAcl.canList(getBinderCallingContext())) {
+    auto timer = mStats.time(kList);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::LIST);
+
+    if (!mAcl->canList(mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         _hidl_cb({});
         return Void();
     }
 
+    std::shared_ptr<const RegistrySnapshot> snapshot = mSnapshot.current();
+
     hidl_vec<hidl_string> list;
 
-    list.resize(countExistingService());
+    list.resize(snapshot->size());
 
     size_t idx = 0;
-    forEachExistingService([&] (const HidlService *service) {
-        list[idx++] = service->string();
+    snapshot->forEach([&] (std::string_view fqName, std::string_view name, const sp<IBase> &) {
+        std::string entry;
+        entry.reserve(fqName.size() + 1 + name.size());
+        entry.append(fqName).append("/").append(name);
+        list[idx++] = entry;
     });
 
+    call.setArg(list.size());
     _hidl_cb(list);
     return Void();
 }
 
 Return<void> ServiceManager::listByInterface(const hidl_string& fqName,
                                              listByInterface_cb _hidl_cb) {
-    if (!mAcl.canGet(fqName, getBinderCallingContext())) {
+    auto timer = mStats.time(kListByInterface);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::LIST_BY_INTERFACE,
+                            toStringView(fqName));
+
+    if (!mAcl->canGet(toStringView(fqName), mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         _hidl_cb({});
         return Void();
     }
 
-    auto ifaceIt = mServiceMap.find(fqName);
-    if (ifaceIt == mServiceMap.end()) {
+    std::shared_ptr<const RegistrySnapshot> snapshot = mSnapshot.current();
+    const RegistrySnapshot::InstanceMap *instanceMap =
+            snapshot->lookupInterface(toStringView(fqName));
+    if (instanceMap == nullptr) {
         _hidl_cb(hidl_vec<hidl_string>());
         return Void();
     }
 
-    const auto &instanceMap = ifaceIt->second.getInstanceMap();
-
     hidl_vec<hidl_string> list;
-
-    size_t total = 0;
-    for (const auto &serviceMapping : instanceMap) {
-        const std::unique_ptr<HidlService> &service = serviceMapping.second;
-        if (service->getService() == nullptr) continue;
-
-        ++total;
-    }
-    list.resize(total);
+    list.resize(instanceMap->size());
 
     size_t idx = 0;
-    for (const auto &serviceMapping : instanceMap) {
-        const std::unique_ptr<HidlService> &service = serviceMapping.second;
-        if (service->getService() == nullptr) continue;
-
-        list[idx++] = service->getInstanceName();
+    for (const auto &serviceMapping : *instanceMap) {
+        list[idx++] = std::string(serviceMapping.first);
     }
 
+    call.setArg(list.size());
     _hidl_cb(list);
     return Void();
 }
@@ -336,27 +384,63 @@ Return<void> ServiceManager::listByInterface(const hidl_string& fqName,
 Return<bool> ServiceManager::registerForNotifications(const hidl_string& fqName,
                                                       const hidl_string& name,
                                                       const sp<IServiceNotification>& callback) {
+    auto timer = mStats.time(kRegisterForNotifications);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::REGISTER_FOR_NOTIFICATIONS,
+                            toStringView(fqName), toStringView(name));
+
     if (callback == nullptr) {
         return false;
     }
+    call.setBinder(identityOf(callback));
 
-    if (!mAcl.canGet(fqName, getBinderCallingContext())) {
+    if (!mAcl->canGet(toStringView(fqName), mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         return false;
     }
 
-    PackageInterfaceMap &ifaceMap = mServiceMap[fqName];
+    std::unique_lock<std::mutex> lock(mLock);
 
-    if (name.empty()) {
+    InternedName interfaceName = mNames.find(toStringView(fqName));
+    InternedName instanceName = name.empty() ? InternedName() : mNames.find(toStringView(name));
+
+    // Registering again is a no-op, so a listener is never notified twice
+    // for one change nor linked to death twice. It can only be registered
+    // already if its names were interned.
+    if (interfaceName && (name.empty() || instanceName) &&
+            mListeners.contains(callback, {interfaceName, instanceName})) {
+        mStats.increment(kDuplicateListener);
+        call.setResult(true);
+        return true;
+    }
+
+    interfaceName = mNames.intern(toStringView(fqName));
+    instanceName = name.empty() ? InternedName() : mNames.intern(toStringView(name));
+    if (!interfaceName || (!name.empty() && !instanceName)) {
+        mStats.increment(kNamePoolFull);
+        LOG(ERROR) << "Too many names registered, cannot register a listener for "
+                   << fqName << "/" << name << ".";
+        return false;
+    }
+
+    PackageInterfaceMap &ifaceMap = mServiceMap[interfaceName];
+
+    if (!instanceName) {
         auto ret = callback->linkToDeath(this, kPackageListenerDiedCookie /*cookie*/);
         if (!ret.isOk()) {
             LOG(ERROR) << "Failed to register death recipient for " << fqName << "/" << name;
             return false;
         }
-        ifaceMap.addPackageListener(callback);
+        ifaceMap.addPackageListener(callback, mNotifications);
+        mListeners.add(callback, {interfaceName, InternedName()});
+
+        lock.unlock();
+        mNotifications.flush();
+        call.setResult(true);
         return true;
     }
 
-    HidlService *service = ifaceMap.lookup(name);
+    HidlService *service = ifaceMap.lookup(instanceName);
 
     auto ret = callback->linkToDeath(this, kServiceListenerDiedCookie);
     if (!ret.isOk()) {
@@ -365,87 +449,394 @@ Return<bool> ServiceManager::registerForNotifications(const hidl_string& fqName,
     }
 
     if (service == nullptr) {
-        auto adding = std::make_unique<HidlService>(fqName, name);
-        adding->addListener(callback);
-        ifaceMap.insertService(std::move(adding));
-    } else {
-        service->addListener(callback);
+        service = ifaceMap.insertService(
+            std::make_unique<HidlService>(interfaceName, instanceName));
+        mJournal.record(RegistryChangeKind::PLACEHOLDER, interfaceName, instanceName);
     }
 
+    service->addListener(callback, mNotifications);
+    mListeners.add(callback, {interfaceName, instanceName});
+
+    lock.unlock();
+    mNotifications.flush();
+    call.setResult(true);
     return true;
 }
 
 Return<bool> ServiceManager::unregisterForNotifications(const hidl_string& fqName,
                                                         const hidl_string& name,
                                                         const sp<IServiceNotification>& callback) {
+    auto timer = mStats.time(kUnregisterForNotifications);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::UNREGISTER_FOR_NOTIFICATIONS,
+                            toStringView(fqName), toStringView(name));
+
     if (callback == nullptr) {
         LOG(ERROR) << "Cannot unregister null callback for " << fqName << "/" << name;
         return false;
     }
+    call.setBinder(identityOf(callback));
 
     // NOTE: don't need ACL since callback is binder token, and if someone has gotten it,
     // then they already have access to it.
 
-    if (fqName.empty()) {
-        bool success = false;
-        success |= removePackageListener(callback);
-        success |= removeServiceListener(callback);
-        return success;
+    std::lock_guard<std::mutex> lock(mLock);
+
+    auto unregister = [&] {
+        if (fqName.empty()) {
+            return removeListener(callback);
+        }
+
+        InternedName interfaceName = mNames.find(toStringView(fqName));
+        if (!interfaceName) {
+            return false;
+        }
+
+        if (name.empty()) {
+            return removeListener(callback, interfaceName);
+        }
+
+        InternedName instanceName = mNames.find(toStringView(name));
+        if (!instanceName) {
+            return false;
+        }
+
+        return removeListener(callback, interfaceName, instanceName);
+    };
+
+    bool removed = unregister();
+    call.setResult(removed);
+    return removed;
+}
+
+Return<void> ServiceManager::getServices(const hidl_vec<hidl_string>& fqNames,
+                                         const hidl_vec<hidl_string>& names,
+                                         getServices_cb _hidl_cb) {
+    auto timer = mStats.time(kGetServices);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET_SERVICES);
+    if (mRecorder != nullptr) {
+        auto join = [](const hidl_vec<hidl_string>& strings) {
+            std::string joined;
+            for (size_t i = 0; i < strings.size(); i++) {
+                joined.append(i == 0 ? "" : ",").append(toStringView(strings[i]));
+            }
+            return joined;
+        };
+        call.setFqName(join(fqNames));
+        call.setInstance(join(names));
     }
 
-    PackageInterfaceMap &ifaceMap = mServiceMap[fqName];
+    if (fqNames.size() != names.size()) {
+        LOG(ERROR) << "getServices: got " << fqNames.size() << " fqNames but "
+                   << names.size() << " names.";
+        _hidl_cb({}, {});
+        return Void();
+    }
 
-    if (name.empty()) {
-        bool success = false;
-        success |= ifaceMap.removePackageListener(callback);
-        success |= ifaceMap.removeServiceListener(callback);
-        return success;
+    // Resolved once for the whole batch.
+    const AccessControlBackend::CallingContext callingContext = mAcl->getCallingContext();
+    std::shared_ptr<const RegistrySnapshot> snapshot = mSnapshot.current();
+
+    hidl_vec<sp<IBase>> services;
+    hidl_vec<bool> allowed;
+    services.resize(fqNames.size());
+    allowed.resize(fqNames.size());
+
+    size_t found = 0;
+    for (size_t i = 0; i < fqNames.size(); i++) {
+        allowed[i] = mAcl->canGet(toStringView(fqNames[i]), callingContext);
+        if (!allowed[i]) {
+            mStats.increment(kAclDenied);
+            call.setDenied();
+            continue;
+        }
+
+        services[i] = snapshot->lookup(toStringView(fqNames[i]), toStringView(names[i]));
+        if (services[i] == nullptr) {
+            mStats.increment(kLookupMiss);
+        } else {
+            found++;
+        }
     }
+    call.setArg(found);
 
-    HidlService *service = ifaceMap.lookup(name);
+    _hidl_cb(services, allowed);
+    return Void();
+}
+
+Return<sp<IBase>> ServiceManager::waitForService(const hidl_string& fqName,
+                                                 const hidl_string& name,
+                                                 int64_t timeoutNanos) {
+    auto timer = mStats.time(kWaitForService);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::WAIT_FOR_SERVICE,
+                            toStringView(fqName), toStringView(name));
+    call.setArg(static_cast<uint64_t>(std::max<int64_t>(timeoutNanos, 0)));
+
+    if (!mAcl->canGet(toStringView(fqName), mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
+        return nullptr;
+    }
+
+    auto lookup = [&] {
+        return mSnapshot.current()->lookup(toStringView(fqName), toStringView(name));
+    };
+
+    sp<IBase> service = lookup();
+
+    // The looper thread runs on the main thread; it must stay free to serve add().
+    if (service != nullptr || timeoutNanos <= 0 || gettid() == getpid()) {
+        call.setResult(service != nullptr);
+        return service;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::nanoseconds(std::min(timeoutNanos, kMaxWaitForServiceNanos));
+
+    std::unique_lock<std::mutex> lock(mLock);
+
+    if (mWaiters >= mMaxWaiters) {
+        LOG(WARNING) << "waitForService: " << mWaiters << " calls already waiting, not waiting for "
+                     << fqName << "/" << name;
+        service = lookup();
+        call.setResult(service != nullptr);
+        return service;
+    }
+
+    mWaiters++;
+    // add() publishes before notifying, so every wakeup sees the latest snapshot.
+    while ((service = lookup()) == nullptr) {
+        if (mServiceAdded.wait_until(lock, deadline) == std::cv_status::timeout) {
+            service = lookup();
+            break;
+        }
+    }
+    mWaiters--;
 
     if (service == nullptr) {
-        return false;
+        mStats.increment(kWaitTimedOut);
     }
+    call.setResult(service != nullptr);
+    return service;
+}
+
+Return<void> ServiceManager::listPage(const hidl_string& prefix,
+                                      const hidl_string& cursor,
+                                      uint32_t maxEntries,
+                                      listPage_cb _hidl_cb) {
+    auto timer = mStats.time(kListPage);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::LIST_PAGE,
+                            toStringView(prefix), toStringView(cursor));
+    call.setArg(maxEntries);
+
+    const std::string_view prefixView = toStringView(prefix);
+    const std::string_view cursorView = toStringView(cursor);
+
+    // "<fqName>/" only matches instances of fqName.
+    const size_t slash = prefixView.find('/');
+    const AccessControlBackend::CallingContext callingContext = mAcl->getCallingContext();
+    const bool allowed = (slash != std::string_view::npos && slash + 1 == prefixView.size())
+            ? mAcl->canGet(prefixView.substr(0, slash), callingContext)
+            : mAcl->canList(callingContext);
+    if (!allowed) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
+        _hidl_cb({}, {});
+        return Void();
+    }
+
+    if (maxEntries == 0 || maxEntries > kMaxListPageEntries) {
+        maxEntries = kMaxListPageEntries;
+    }
+
+    std::shared_ptr<const RegistrySnapshot> snapshot = mSnapshot.current();
+    const RegistrySnapshot::SortedEntries &entries = snapshot->sortedEntries();
+
+    // The first entry that starts with prefix and sorts after cursor.
+    auto it = (!cursor.empty() && cursorView >= prefixView)
+            ? snapshot->upperBound(cursorView)
+            : snapshot->lowerBound(prefixView);
 
-    return service->removeListener(callback);
+    std::vector<hidl_string> page;
+    for (; it != entries.end() && page.size() < maxEntries && it->startsWith(prefixView); ++it) {
+        page.push_back(it->joined());
+    }
+
+    hidl_string nextCursor;
+    if (it != entries.end() && it->startsWith(prefixView)) {
+        nextCursor = page.back();
+    }
+
+    _hidl_cb(page, nextCursor);
+    return Void();
+}
+
+Return<uint64_t> ServiceManager::getGeneration() {
+    auto timer = mStats.time(kGetGeneration);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET_GENERATION);
+
+    if (!mAcl->canList(mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
+        return 0;
+    }
+
+    return mJournal.generation();
+}
+
+Return<void> ServiceManager::getChangesSince(uint64_t generation,
+                                             getChangesSince_cb _hidl_cb) {
+    auto timer = mStats.time(kGetChangesSince);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET_CHANGES_SINCE);
+    // Generations of an earlier manager would wrap around.
+    const uint64_t firstGeneration = mJournal.firstGeneration();
+    call.setArg(generation < firstGeneration ? 0 : generation - firstGeneration + 1);
+
+    if (!mAcl->canList(mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
+        _hidl_cb(0, true /* resync */, {});
+        return Void();
+    }
+
+    std::unique_lock<std::mutex> lock(mLock);
+
+    hidl_vec<RegistryChange> changes;
+    bool complete = mJournal.changesSince(generation, &changes);
+    uint64_t currentGeneration = mJournal.generation();
+
+    lock.unlock();
+
+    call.setResult(complete);
+    _hidl_cb(currentGeneration, !complete, changes);
+    return Void();
 }
 
 Return<void> ServiceManager::debugDump(debugDump_cb _cb) {
-    if (!mAcl.canList(getBinderCallingContext())) {
+    auto timer = mStats.time(kDebugDump);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::DEBUG_DUMP);
+
+    if (!mAcl->canList(mAcl->getCallingContext())) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         _cb({});
         return Void();
     }
 
+    std::unique_lock<std::mutex> lock(mLock);
+
     std::vector<IServiceManager::InstanceDebugInfo> list;
+    std::vector<PassthroughClients> clients;
+    std::vector<std::pair<InternedName, InternedName>> entries;
     forEachServiceEntry([&] (const HidlService *service) {
-        hidl_vec<int32_t> clientPids;
-        clientPids.resize(service->getPassthroughClients().size());
-
-        size_t i = 0;
-        for (pid_t p : service->getPassthroughClients()) {
-            clientPids[i++] = p;
-        }
-
         list.push_back({
             .pid = service->getDebugPid(),
             .interfaceName = service->getInterfaceName(),
             .instanceName = service->getInstanceName(),
-            .clientPids = clientPids,
+            .clientPids = {},
             .arch = ::android::hidl::base::V1_0::DebugInfo::Architecture::UNKNOWN
         });
+        clients.push_back(service->getPassthroughClients());
+        entries.emplace_back(service->getInternedInterfaceName(),
+                             service->getInternedInstanceName());
     });
 
+    lock.unlock();
+
+    // Checking which clients are still alive reads /proc, so do it unlocked.
+    std::vector<std::vector<PassthroughClients::Client>> dead(list.size());
+    bool anyDead = false;
+    for (size_t i = 0; i < list.size(); i++) {
+        list[i].clientPids = clients[i].live(&dead[i]);
+        anyDead |= !dead[i].empty();
+    }
+
+    // Forget the dead clients, so the lists only hold live ones up to the
+    // next dump. Entries are never removed, only emptied.
+    if (anyDead) {
+        lock.lock();
+        for (size_t i = 0; i < list.size(); i++) {
+            if (dead[i].empty()) {
+                continue;
+            }
+            PackageInterfaceMap *ifaceMap = mServiceMap.find(entries[i].first);
+            HidlService *service =
+                    ifaceMap == nullptr ? nullptr : ifaceMap->lookup(entries[i].second);
+            if (service != nullptr) {
+                service->removePassthroughClients(dead[i]);
+            }
+        }
+        lock.unlock();
+    }
+
     _cb(list);
     return Void();
 }
 
 
+Return<void> ServiceManager::debug(const hidl_handle& fd,
+                                   const hidl_vec<hidl_string>& options) {
+    const native_handle_t *handle = fd.getNativeHandle();
+    if (handle == nullptr || handle->numFds < 1) {
+        LOG(ERROR) << "debug: no file descriptor to write to.";
+        return Void();
+    }
+    int out = handle->data[0];
+
+    if (!mAcl->canList(mAcl->getCallingContext())) {
+        android::base::WriteStringToFd("Permission denied.\n", out);
+        return Void();
+    }
+
+    if (options.size() == 2 && options[0] == "--pid") {
+        pid_t pid;
+        if (!android::base::ParseInt(options[1].c_str(), &pid)) {
+            android::base::WriteStringToFd("Invalid pid: " + std::string(options[1]) + "\n", out);
+            return Void();
+        }
+
+        std::lock_guard<std::mutex> lock(mLock);
+
+        std::stringstream ss;
+        for (const HidlService *service : mRegistrations.findByPid(pid)) {
+            ss << service->string() << std::endl;
+        }
+        android::base::WriteStringToFd(ss.str(), out);
+        return Void();
+    }
+
+    if (options.size() == 1 && options[0] == "--stats") {
+        android::base::WriteStringToFd(mStats.dump() + "\nnotification delivery:\n" +
+                                       mNotifications.stats().dump(), out);
+        return Void();
+    }
+
+    if (options.size() == 1 && options[0] == "--flush-trace") {
+        if (mRecorder == nullptr) {
+            android::base::WriteStringToFd("Not recording.\n", out);
+            return Void();
+        }
+        mRecorder->flush();
+        return Void();
+    }
+
+    android::base::WriteStringToFd(
+        "usage: debug [--pid <pid> | --stats | --flush-trace]\n"
+        "    --pid <pid>: list the fqName/instance entries registered by pid\n"
+        "    --stats: per-method latencies and event counters since startup\n"
+        "    --flush-trace: write out the calls recorded so far\n", out);
+    return Void();
+}
+
 Return<void> ServiceManager::registerPassthroughClient(const hidl_string &fqName,
         const hidl_string &name) {
-    auto callingContext = getBinderCallingContext();
-
-    if (!mAcl.canGet(fqName, callingContext)) {
+    auto timer = mStats.time(kRegisterPassthroughClient);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::REGISTER_PASSTHROUGH_CLIENT,
+                            toStringView(fqName), toStringView(name));
+    auto callingContext = mAcl->getCallingContext();
+
+    if (!mAcl->canGet(toStringView(fqName), callingContext)) {
+        mStats.increment(kAclDenied);
+        call.setDenied();
         /* We guard this function with "get", because it's typically used in
          * the getService() path, albeit for a passthrough service in this
          * case
@@ -453,61 +844,83 @@ Return<void> ServiceManager::registerPassthroughClient(const hidl_string &fqName
         return Void();
     }
 
-    PackageInterfaceMap &ifaceMap = mServiceMap[fqName];
-
     if (name.empty()) {
         LOG(WARNING) << "registerPassthroughClient encounters empty instance name for "
                      << fqName.c_str();
         return Void();
     }
 
-    HidlService *service = ifaceMap.lookup(name);
+    // Reads /proc, so not under mLock.
+    const uint64_t startTime = PassthroughClients::processStartTime(callingContext.pid);
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    InternedName interfaceName = mNames.intern(toStringView(fqName));
+    InternedName instanceName = mNames.intern(toStringView(name));
+    if (!interfaceName || !instanceName) {
+        mStats.increment(kNamePoolFull);
+        LOG(ERROR) << "Too many names registered, cannot record a passthrough client of "
+                   << fqName << "/" << name << ".";
+        return Void();
+    }
+
+    PackageInterfaceMap &ifaceMap = mServiceMap[interfaceName];
+    HidlService *service = ifaceMap.lookup(instanceName);
 
     if (service == nullptr) {
-        auto adding = std::make_unique<HidlService>(fqName, name);
-        adding->registerPassthroughClient(callingContext.pid);
+        auto adding = std::make_unique<HidlService>(interfaceName, instanceName);
+        adding->registerPassthroughClient(callingContext.pid, startTime);
         ifaceMap.insertService(std::move(adding));
     } else {
-        service->registerPassthroughClient(callingContext.pid);
+        service->registerPassthroughClient(callingContext.pid, startTime);
     }
     return Void();
 }
 
 bool ServiceManager::removeService(const wp<IBase>& who) {
-    using ::android::hardware::interfacesEqual;
+    std::vector<HidlService *> entries = mRegistrations.findByService(who.promote());
 
-    bool found = false;
-    for (auto &interfaceMapping : mServiceMap) {
-        auto &instanceMap = interfaceMapping.second.getInstanceMap();
-
-        for (auto &servicePair : instanceMap) {
-            const std::unique_ptr<HidlService> &service = servicePair.second;
-            if (interfacesEqual(service->getService(), who.promote())) {
-                service->setService(nullptr, static_cast<pid_t>(IServiceManager::PidConstant::NO_PID));
-                found = true;
-            }
-        }
+    for (HidlService *service : entries) {
+        setService(service, nullptr, static_cast<pid_t>(IServiceManager::PidConstant::NO_PID));
     }
-    return found;
+    mSnapshot.publish();
+
+    return !entries.empty();
 }
 
-bool ServiceManager::removePackageListener(const wp<IBase>& who) {
-    bool found = false;
+void ServiceManager::setService(HidlService *entry, const sp<IBase>& service, pid_t pid) {
+    mRegistrations.remove(entry);
+    entry->setService(service, pid);
+    mRegistrations.add(entry);
 
-    for (auto &interfaceMapping : mServiceMap) {
-        found |= interfaceMapping.second.removePackageListener(who);
-    }
+    mSnapshot.stage(entry->getInternedInterfaceName(), entry->getInternedInstanceName(), service);
 
-    return found;
+    mJournal.record(service == nullptr ? RegistryChangeKind::REMOVED : RegistryChangeKind::ADDED,
+                    entry->getInternedInterfaceName(), entry->getInternedInstanceName());
 }
 
-bool ServiceManager::removeServiceListener(const wp<IBase>& who) {
+bool ServiceManager::removeListener(const sp<IBase>& listener,
+                                    InternedName interfaceName,
+                                    InternedName instanceName) {
     bool found = false;
-    for (auto &interfaceMapping : mServiceMap) {
-        auto &packageInterfaceMap = interfaceMapping.second;
 
-        found |= packageInterfaceMap.removeServiceListener(who);
+    for (const auto &subscription : mListeners.remove(listener, interfaceName, instanceName)) {
+        PackageInterfaceMap *ifaceMap = mServiceMap.find(subscription.interfaceName);
+        if (ifaceMap == nullptr) {
+            continue;
+        }
+
+        if (!subscription.instanceName) {
+            found |= ifaceMap->removePackageListener(listener);
+            continue;
+        }
+
+        HidlService *service = ifaceMap->lookup(subscription.instanceName);
+        if (service != nullptr) {
+            found |= service->removeListener(listener);
+        }
     }
+
     return found;
 }
 }  // namespace implementation
@@ -4,10 +4,22 @@
 #include <android/hidl/manager/1.1/IServiceManager.h>
 #include <hidl/Status.h>
 #include <hidl/MQDescriptor.h>
-#include <map>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
 
-#include "AccessControl.h"
+#include "AccessControlBackend.h"
+#include "CallRecorder.h"
+#include "ChangeJournal.h"
+#include "FlatHashMap.h"
 #include "HidlService.h"
+#include "ListenerRegistry.h"
+#include "MethodStats.h"
+#include "NamePool.h"
+#include "NotificationQueue.h"
+#include "RegistrationIndex.h"
+#include "RegistrySnapshot.h"
 
 namespace android {
 namespace hidl {
@@ -15,6 +27,7 @@ namespace manager {
 namespace implementation {
 
 using ::android::hardware::hidl_death_recipient;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_vec;
 using ::android::hardware::hidl_string;
 using ::android::hardware::Return;
@@ -26,6 +39,20 @@ using ::android::sp;
 using ::android::wp;
 
 struct ServiceManager : public IServiceManager, hidl_death_recipient {
+    /**
+     * acl decides every add/get/list; hwservicemanager passes an
+     * AccessControl. maxWaiters bounds how many waitForService() calls may
+     * be parked at once. Keep it below the number of binder threads so a
+     * thread is always free for the add() that wakes them.
+     */
+    explicit ServiceManager(std::unique_ptr<AccessControlBackend> acl, size_t maxWaiters = 0);
+
+    /**
+     * Records every call served from now on, see CallRecorder. Set it
+     * before serving any call; nullptr (the default) records nothing.
+     */
+    void setRecorder(std::shared_ptr<CallRecorder> recorder);
+
     // Methods from ::android::hidl::manager::V1_0::IServiceManager follow.
     Return<sp<IBase>> get(const hidl_string& fqName,
                           const hidl_string& name) override;
@@ -52,18 +79,138 @@ struct ServiceManager : public IServiceManager, hidl_death_recipient {
                                             const hidl_string& name,
                                             const sp<IServiceNotification>& callback) override;
 
+    // Methods served as hwservicemanager.ext@1.0::IServiceManagerExt follow,
+    // through ServiceManagerExt; see interfaces/ext/1.0.
+
+    /**
+     * Looks up fqNames[i]/names[i] for every i in one call. services[i] is
+     * nullptr if the instance isn't registered or allowed[i] is false.
+     * Returns empty vectors if fqNames and names differ in size.
+     */
+    using getServices_cb = std::function<void(const hidl_vec<sp<IBase>>& services,
+                                              const hidl_vec<bool>& allowed)>;
+    Return<void> getServices(const hidl_vec<hidl_string>& fqNames,
+                             const hidl_vec<hidl_string>& names,
+                             getServices_cb _hidl_cb);
+
+    /**
+     * Like get(), but if fqName/name isn't registered yet, parks the call
+     * until add() registers it or timeoutNanos (capped at
+     * kMaxWaitForServiceNanos) pass, whichever comes first. Returns nullptr
+     * on timeout.
+     *
+     * Doesn't wait when called on the looper thread, when timeoutNanos <= 0
+     * or when maxWaiters calls are already parked; the caller should then
+     * fall back to registerForNotifications().
+     */
+    Return<sp<IBase>> waitForService(const hidl_string& fqName,
+                                     const hidl_string& name,
+                                     int64_t timeoutNanos);
+
+    static constexpr int64_t kMaxWaitForServiceNanos = 5'000'000'000;
+
+    /**
+     * Pages through list() in sorted order. Returns at most maxEntries
+     * (at most kMaxListPageEntries; 0 for that maximum) "fqName/name"
+     * entries that start with prefix and sort after cursor. Pass an empty
+     * cursor for the first page and the returned nextCursor for the next
+     * ones; nextCursor is empty after the last page.
+     *
+     * The prefix "<fqName>/" pages through the instances of fqName and,
+     * like listByInterface(fqName), only needs permission to get fqName.
+     * Any other prefix needs permission to list().
+     */
+    using listPage_cb = std::function<void(const hidl_vec<hidl_string>& entries,
+                                           const hidl_string& nextCursor)>;
+    Return<void> listPage(const hidl_string& prefix,
+                          const hidl_string& cursor,
+                          uint32_t maxEntries,
+                          listPage_cb _hidl_cb);
+
+    static constexpr uint32_t kMaxListPageEntries = 256;
+
+    /**
+     * Current registry generation. Bumped by every service added or
+     * removed and every placeholder entry created for a listener. Never
+     * goes back across a restart of hwservicemanager, see ChangeJournal.
+     */
+    Return<uint64_t> getGeneration();
+
+    /**
+     * Returns the changes after generation, oldest first, and the current
+     * generation. resync is true (and changes empty) if the journal no
+     * longer holds all of them or generation is from before a restart;
+     * the client should list() again.
+     */
+    using getChangesSince_cb = std::function<void(uint64_t currentGeneration,
+                                                  bool resync,
+                                                  const hidl_vec<RegistryChange>& changes)>;
+    Return<void> getChangesSince(uint64_t generation, getChangesSince_cb _hidl_cb);
+
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+
+    /**
+     * Debug commands, e.x. "lshal debug android.hidl.manager@1.0::IServiceManager --pid 123".
+     *     --pid <pid>: list the fqName/instance entries registered by pid
+     *     --stats: per-method latencies and event counters since startup,
+     *              including notification delivery
+     *     --flush-trace: write out the calls recorded so far, see setRecorder()
+     */
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
     virtual void serviceDied(uint64_t cookie, const wp<IBase>& who);
 private:
+    // Indexes into mStats.
+    enum Method : size_t {
+        kGet,
+        kAdd,
+        kGetTransport,
+        kList,
+        kListByInterface,
+        kRegisterForNotifications,
+        kUnregisterForNotifications,
+        kRegisterPassthroughClient,
+        kGetServices,
+        kWaitForService,
+        kListPage,
+        kGetGeneration,
+        kGetChangesSince,
+        kDebugDump,
+    };
+    enum Counter : size_t {
+        kAclDenied,
+        kLookupMiss,
+        kDroppedCallback,
+        kWaitTimedOut,
+        kDuplicateListener,
+        kNamePoolFull,
+    };
+
     bool removeService(const wp<IBase>& who);
-    bool removePackageListener(const wp<IBase>& who);
-    bool removeServiceListener(const wp<IBase>& who);
-    size_t countExistingService() const;
-    void forEachExistingService(std::function<void(const HidlService *)> f) const;
+
+    // Drops every subscription of a listener that failed to take a notification.
+    void onNotificationDropped(const sp<IServiceNotification>& listener,
+                               NotificationQueue::DropReason reason);
+
+    /**
+     * Changes the service behind entry, keeping mRegistrations and the
+     * staged snapshot in sync. Doesn't notify listeners or publish.
+     */
+    void setService(HidlService *entry, const sp<IBase>& service, pid_t pid);
+
+    /**
+     * Unsubscribes listener as selected by ListenerRegistry::remove().
+     * Returns true if any subscription was removed.
+     */
+    bool removeListener(const sp<IBase>& listener,
+                        InternedName interfaceName = InternedName(),
+                        InternedName instanceName = InternedName());
     void forEachServiceEntry(std::function<void(const HidlService *)> f) const;
 
-    using InstanceMap = std::map<
-            std::string, // instance name e.x. "manager"
-            std::unique_ptr<HidlService>
+    using InstanceMap = FlatHashMap<
+            InternedName, // instance name e.x. "manager"
+            std::unique_ptr<HidlService>,
+            InternedName::Hash
         >;
 
     struct PackageInterfaceMap {
@@ -77,40 +224,113 @@ private:
          * value should be treated as a temporary reference.
          */
         HidlService *lookup(
-            const std::string &name);
+            InternedName name);
         const HidlService *lookup(
-            const std::string &name) const;
+            InternedName name) const;
 
-        void insertService(std::unique_ptr<HidlService> &&service);
+        HidlService *insertService(std::unique_ptr<HidlService> &&service);
 
-        void addPackageListener(sp<IServiceNotification> listener);
-        bool removePackageListener(const wp<IBase>& who);
-        bool removeServiceListener(const wp<IBase>& who);
+        /**
+         * Queues preexisting notifications for the instances already
+         * registered. Returns false, doing nothing, if listener was added before.
+         */
+        bool addPackageListener(sp<IServiceNotification> listener,
+                                NotificationQueue &notifications);
+        bool removePackageListener(const sp<IBase>& listener);
 
         void sendPackageRegistrationNotification(
-            const hidl_string &fqName,
-            const hidl_string &instanceName);
+            const HidlService &service,
+            NotificationQueue &notifications) const;
 
     private:
         InstanceMap mInstanceMap{};
 
-        std::vector<sp<IServiceNotification>> mPackageListeners{};
+        ListenerSet mPackageListeners{};
     };
 
-    AccessControl mAcl;
+    const std::unique_ptr<AccessControlBackend> mAcl;
+
+    /**
+     * Latency of every IServiceManager method and counts of ACL denials,
+     * lookups that found nothing and dropped notifications. Lock-free.
+     */
+    MethodStats mStats;
+
+    std::shared_ptr<CallRecorder> mRecorder;
 
     /**
-     * Access to this map doesn't need to be locked, since hwservicemanager
-     * is single-threaded.
+     * Serializes everything that reads or modifies the members below, apart
+     * from mSnapshot.current(). Never held across a synchronous binder call,
+     * nor for work that grows with the size of the registry on a read.
+     */
+    std::mutex mLock;
+
+    /**
+     * Every interface and instance name known to mServiceMap. Must outlive
+     * mServiceMap, which is keyed by handles into it. Only add(),
+     * registerForNotifications() and registerPassthroughClient() intern
+     * names; calls that only look names up use find(), so they never grow
+     * it.
+     */
+    NamePool mNames;
+
+    /**
+     * Guarded by mLock. get(), list() and listByInterface() don't look at
+     * this map; they read mSnapshot without locking instead.
+     *
+     * Both levels are hashed on interned names. A lookup resolves the
+     * incoming hidl_strings with mNames.find() first, so it doesn't allocate
+     * and never compares name bytes past that point.
      *
      * e.x.
      * mServiceMap["android.hidl.manager@1.0::IServiceManager"]["manager"]
      *     -> HidlService object
      */
-    std::map<
-        std::string, // package::interface e.x. "android.hidl.manager@1.0::IServiceManager"
-        PackageInterfaceMap
+    FlatHashMap<
+        InternedName, // package::interface e.x. "android.hidl.manager@1.0::IServiceManager"
+        PackageInterfaceMap,
+        InternedName::Hash
     > mServiceMap;
+
+    /**
+     * Which entries of mServiceMap each registered binder and pid backs.
+     * Kept in sync with every HidlService::setService() call.
+     */
+    RegistrationIndex mRegistrations;
+
+    /**
+     * Where each IServiceNotification is subscribed. Kept in sync with
+     * every listener added to or removed from mServiceMap.
+     */
+    ListenerRegistry mListeners;
+
+    /**
+     * Generation and recent changes of mServiceMap. Recorded and read
+     * under mLock, apart from the generation itself.
+     */
+    ChangeJournal mJournal;
+
+    /**
+     * onRegistration() calls queued under mLock. Whoever queues them
+     * flushes after releasing mLock, which hands them to the delivery
+     * thread; neither add() nor registerForNotifications() wait for them.
+     */
+    NotificationQueue mNotifications;
+
+    /**
+     * Notified with mLock held after every add() publishes, so parked
+     * waitForService() calls can look again. mWaiters counts them and is
+     * guarded by mLock.
+     */
+    std::condition_variable mServiceAdded;
+    size_t mWaiters = 0;
+    const size_t mMaxWaiters;
+
+    /**
+     * Copy-on-write copy of the services in mServiceMap, republished after
+     * every change, so reads never wait for mLock.
+     */
+    SnapshotPublisher mSnapshot;
 };
 
 }  // namespace implementation
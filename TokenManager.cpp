@@ -2,8 +2,12 @@
 
 #include "TokenManager.h"
 
+#include <algorithm>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <functional>
+#include <hidl/HidlBinderSupport.h>
+#include <sstream>
 #include <log/log.h>
 #include <openssl/hmac.h>
 #include <openssl/rand.h>
@@ -32,123 +36,453 @@ static void ReadRandomBytes(uint8_t *buf, size_t len) {
     close(fd);
 }
 
-TokenManager::TokenManager() {
+TokenManager::TokenManager(std::function<pid_t()> getCallingPid, Limits limits,
+                           std::function<bool()> canDebug)
+    : mHmac(HMAC_CTX_new(), HMAC_CTX_free),
+      mGetCallingPid(std::move(getCallingPid)),
+      mCanDebug(std::move(canDebug)),
+      mLimits(limits),
+      mStats({"createToken", "unregister", "get", "createTokens"},
+             {"create_failed", "token_miss", "reclaimed_on_death", "evicted",
+              "quota_exceeded"}) {
     ReadRandomBytes(mKey.data(), mKey.size());
+
+    mHmacKeyed = mHmac != nullptr &&
+            HMAC_Init_ex(mHmac.get(), mKey.data(), mKey.size(), EVP_sha256(), nullptr);
+    if (!mHmacKeyed) {
+        ALOGE("Failed to set up HMAC, no tokens can be created.");
+    }
+}
+
+void TokenManager::setRecorder(std::shared_ptr<CallRecorder> recorder) {
+    mRecorder = std::move(recorder);
+}
+
+size_t TokenManager::liveTokens() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mLiveTokens;
 }
 
 // Methods from ::android::hidl::token::V1_0::ITokenManager follow.
 Return<void> TokenManager::createToken(const sp<IBase>& store, createToken_cb hidl_cb) {
-    TokenInterface interface = generateToken(store);
+    auto timer = mStats.time(kCreateToken);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::CREATE_TOKEN);
+    call.setBinder(identityOf(store));
 
-    if (interface.interface == nullptr) {
+    if (store == nullptr) {
+        mStats.increment(kCreateFailed);
         hidl_cb({});
         return Void();
     }
 
-    uint64_t id = getTokenId(interface.token);
+    const pid_t creator = mGetCallingPid ? mGetCallingPid() : 0;
+    std::vector<sp<IBase>> released; // dropped after mLock; may be remote objects
+    std::vector<sp<IBase>> unlinked;
+    std::vector<sp<IBase>> orphaned;
+    std::unique_lock<std::mutex> lock(mLock);
 
-    if (id == TOKEN_ID_NONE) {
+    hidl_vec<uint8_t> token = createTokenLocked(store, creator, &released, &unlinked, &orphaned);
+    lock.unlock();
+
+    linkToDeathOf(unlinked);
+    unlinkFromDeathOf(orphaned);
+
+    if (token.size() == 0) {
+        mStats.increment(kCreateFailed);
         hidl_cb({});
         return Void();
     }
 
-    mMap[id] = interface;
+    call.setResult(true);
+    call.setArg(getTokenId(token));
 
-    hidl_cb(interface.token);
+    hidl_cb(token);
     return Void();
 }
 
-std::unordered_map<uint64_t,  TokenManager::TokenInterface>::const_iterator
-        TokenManager::lookupToken(const hidl_vec<uint8_t> &token) {
-    uint64_t tokenId = getTokenId(token);
+Return<void> TokenManager::createTokens(const hidl_vec<sp<IBase>>& stores,
+                                        createTokens_cb _hidl_cb) {
+    auto timer = mStats.time(kCreateTokens);
+
+    if (stores.size() > kMaxCreateTokens) {
+        ALOGE("createTokens: got %zu stores, at most %zu are allowed.",
+              stores.size(), kMaxCreateTokens);
+        _hidl_cb({});
+        return Void();
+    }
 
-    if (tokenId == TOKEN_ID_NONE) {
-        return mMap.end();
+    hidl_vec<hidl_vec<uint8_t>> tokens;
+    tokens.resize(stores.size());
+
+    const pid_t creator = mGetCallingPid ? mGetCallingPid() : 0;
+    std::vector<sp<IBase>> released; // dropped after mLock; may be remote objects
+    std::vector<sp<IBase>> unlinked;
+    std::vector<sp<IBase>> orphaned;
+    std::unique_lock<std::mutex> lock(mLock);
+
+    for (size_t i = 0; i < stores.size(); i++) {
+        // Recorded as separate createToken() calls, so each token can be replayed.
+        CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::CREATE_TOKEN);
+        call.setBinder(identityOf(stores[i]));
+
+        if (stores[i] != nullptr) {
+            tokens[i] = createTokenLocked(stores[i], creator, &released, &unlinked, &orphaned);
+        }
+        if (tokens[i].size() == 0) {
+            mStats.increment(kCreateFailed);
+            continue;
+        }
+
+        call.setResult(true);
+        call.setArg(getTokenId(tokens[i]));
     }
 
-    auto it = mMap.find(tokenId);
+    lock.unlock();
+
+    linkToDeathOf(unlinked);
+    unlinkFromDeathOf(orphaned);
 
-    if (it == mMap.end()) {
-        return mMap.end();
+    _hidl_cb(tokens);
+    return Void();
+}
+
+TokenManager::Slot *TokenManager::lookupToken(const hidl_vec<uint8_t> &token) {
+    if (token.size() != ID_SIZE + HMAC_SIZE) {
+        return nullptr;
     }
 
-    const TokenInterface &interface = it->second;
+    const uint64_t tokenId = getTokenId(token);
+    const uint32_t index = static_cast<uint32_t>(tokenId);
+    const uint32_t generation = static_cast<uint32_t>(tokenId >> 32);
+
+    if (index >= mSlots.size()) {
+        return nullptr;
+    }
+
+    Slot &slot = mSlots[index];
+
+    if (slot.interface == nullptr || slot.generation != generation) {
+        return nullptr;
+    }
 
-    if (!constantTimeCompare(token, interface.token)) {
+    if (!constantTimeCompare(token.data() + ID_SIZE, slot.hmac.data(), HMAC_SIZE)) {
         ALOGE("Fetch of token with invalid hash.");
-        return mMap.end();
+        return nullptr;
     }
 
-    return it;
+    return &slot;
 }
 
 Return<bool> TokenManager::unregister(const hidl_vec<uint8_t> &token) {
-    auto it = lookupToken(token);
+    auto timer = mStats.time(kUnregister);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::UNREGISTER_TOKEN);
+    call.setArg(getTokenId(token));
+    std::unique_lock<std::mutex> lock(mLock);
+
+    Slot *slot = lookupToken(token);
 
-    if (it == mMap.end()) {
+    if (slot == nullptr) {
+        mStats.increment(kTokenMiss);
         return false;
     }
 
-    mMap.erase(it);
+    // Drop the last reference outside mLock; it may be a remote object.
+    std::vector<sp<IBase>> orphaned;
+    sp<IBase> interface = freeSlot(slot - mSlots.data(), &orphaned);
+    lock.unlock();
+
+    unlinkFromDeathOf(orphaned);
+
+    call.setResult(true);
     return true;
 }
 
 Return<sp<IBase>> TokenManager::get(const hidl_vec<uint8_t> &token) {
-    auto it = lookupToken(token);
+    auto timer = mStats.time(kGet);
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::GET_TOKEN);
+    call.setArg(getTokenId(token));
+    std::lock_guard<std::mutex> lock(mLock);
+
+    Slot *slot = lookupToken(token);
 
-    if (it == mMap.end()) {
+    if (slot == nullptr) {
+        mStats.increment(kTokenMiss);
         return nullptr;
     }
 
-    return it->second.interface;
+    const uint32_t index = slot - mSlots.data();
+    lruRemove(index);
+    lruAppend(index);
+
+    call.setResult(true);
+    return slot->interface;
+}
+
+// Methods from ::android::hidl::base::V1_0::IBase follow.
+Return<void> TokenManager::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
+    const native_handle_t *handle = fd.getNativeHandle();
+    if (handle == nullptr || handle->numFds < 1) {
+        ALOGE("debug: no file descriptor to write to.");
+        return Void();
+    }
+    int out = handle->data[0];
+
+    if (!mCanDebug || !mCanDebug()) {
+        android::base::WriteStringToFd("Permission denied.\n", out);
+        return Void();
+    }
+
+    if (options.size() == 1 && options[0] == "--stats") {
+        android::base::WriteStringToFd(
+                mStats.dump() + "live_tokens: " + std::to_string(liveTokens()) + "\n", out);
+        return Void();
+    }
+
+    if (options.size() == 1 && options[0] == "--tokens") {
+        std::unique_lock<std::mutex> lock(mLock);
+        const size_t live = mLiveTokens;
+        std::vector<std::pair<size_t, pid_t>> creators;
+        for (const auto &entry : mTokensByCreator) {
+            creators.push_back({entry.second, entry.first});
+        }
+        lock.unlock();
+
+        std::sort(creators.rbegin(), creators.rend());
+
+        std::stringstream ss;
+        ss << "live tokens: " << live;
+        if (mLimits.maxTokens != 0) {
+            ss << " (max " << mLimits.maxTokens << ")";
+        }
+        ss << std::endl << "pid: tokens";
+        if (mLimits.maxTokensPerCreator != 0) {
+            ss << " (max " << mLimits.maxTokensPerCreator << " each)";
+        }
+        ss << std::endl;
+        for (const auto &creator : creators) {
+            ss << creator.second << ": " << creator.first << std::endl;
+        }
+        android::base::WriteStringToFd(ss.str(), out);
+        return Void();
+    }
+
+    android::base::WriteStringToFd(
+        "usage: debug [--stats | --tokens]\n"
+        "    --stats: per-method latencies and event counters since startup\n"
+        "    --tokens: live tokens, in total and per creating pid\n", out);
+    return Void();
+}
+
+void TokenManager::serviceDied(uint64_t /* cookie */, const wp<IBase>& who) {
+    CallRecorder::Call call(mRecorder.get(), CallRecorder::Method::SERVICE_DIED);
+
+    sp<IBase> interface = who.promote();
+    const void *identity = identityOf(interface);
+    call.setBinder(identity);
+
+    std::vector<sp<IBase>> released; // dropped after mLock
+    std::unique_lock<std::mutex> lock(mLock);
+
+    Store *store = mStores.find(identity);
+    if (store == nullptr) {
+        return;
+    }
+
+    // Forget the store first, so freeSlot() doesn't orphan a dead binder.
+    std::vector<uint32_t> slots = std::move(store->slots);
+    mStores.erase(identity);
+
+    std::vector<sp<IBase>> orphaned; // stays empty, see above
+    for (uint32_t index : slots) {
+        released.push_back(freeSlot(index, &orphaned));
+        mStats.increment(kReclaimed);
+    }
+    lock.unlock();
+}
+
+hidl_vec<uint8_t> TokenManager::createTokenLocked(const sp<IBase> &interface, pid_t creator,
+                                                  std::vector<sp<IBase>> *released,
+                                                  std::vector<sp<IBase>> *unlinked,
+                                                  std::vector<sp<IBase>> *orphaned) {
+    if (mLimits.maxTokensPerCreator != 0) {
+        const size_t *created = mTokensByCreator.find(creator);
+        if (created != nullptr && *created >= mLimits.maxTokensPerCreator) {
+            ALOGW("pid %d is at its limit of %zu tokens.", creator, mLimits.maxTokensPerCreator);
+            mStats.increment(kQuotaExceeded);
+            return {};
+        }
+    }
+
+    hidl_vec<uint8_t> token = generateToken(interface, creator);
+    if (token.size() == 0) {
+        return token;
+    }
+
+    const uint32_t index = static_cast<uint32_t>(getTokenId(token));
+    auto inserted = mStores.insert(mSlots[index].identity, Store());
+    Store &store = *inserted.first;
+    if (inserted.second) {
+        store.interface = interface;
+        unlinked->push_back(interface);
+    }
+    mSlots[index].storePos = store.slots.size();
+    store.slots.push_back(index);
+
+    // Only evict once the new token exists, so a failed call drops nothing.
+    // The new token is the most recently used, so it isn't the one evicted.
+    if (mLimits.maxTokens != 0 && mLiveTokens > mLimits.maxTokens) {
+        released->push_back(freeSlot(mLruHead, orphaned));
+        mStats.increment(kEvicted);
+    }
+
+    return token;
+}
+
+void TokenManager::linkToDeathOf(const std::vector<sp<IBase>> &interfaces) {
+    for (const sp<IBase> &interface : interfaces) {
+        auto ret = interface->linkToDeath(this, 0 /* cookie */);
+        if (!ret.isOk() || !ret) {
+            LOG(WARNING) << "Failed to link to death of a token's interface; "
+                         << "its tokens are kept until unregistered.";
+        }
+    }
+}
+
+void TokenManager::unlinkFromDeathOf(const std::vector<sp<IBase>> &interfaces) {
+    for (const sp<IBase> &interface : interfaces) {
+        auto ret = interface->unlinkToDeath(this);
+        ret.isOk(); // ignore
+    }
 }
 
 
-TokenManager::TokenInterface TokenManager::generateToken(const sp<IBase> &interface) {
-    uint64_t id = ++mTokenIndex;
+hidl_vec<uint8_t> TokenManager::generateToken(const sp<IBase> &interface, pid_t creator) {
+    const bool reuse = !mFreeSlots.empty();
+    if (!reuse && mSlots.size() >= kNoSlot) {
+        ALOGE("Generating token failed, out of slots.");
+        return {};
+    }
+
+    const uint32_t index = reuse ? mFreeSlots.back() : mSlots.size();
+    const uint32_t generation = reuse ? mSlots[index].generation : Slot().generation;
+    uint64_t id = makeTokenId(index, generation);
 
     std::array<uint8_t, EVP_MAX_MD_SIZE> hmac;
-    uint32_t hmacSize;
+    uint32_t hmacSize = 0;
+
+    // With no key and no digest, HMAC_Init_ex() restores the keyed state.
+    if (!mHmacKeyed ||
+            !HMAC_Init_ex(mHmac.get(), nullptr, 0, nullptr, nullptr) ||
+            !HMAC_Update(mHmac.get(), (uint8_t*) &id, ID_SIZE) ||
+            !HMAC_Final(mHmac.get(), hmac.data(), &hmacSize) ||
+            hmacSize != HMAC_SIZE) {
+        ALOGE("Generating token failed, got %u bytes of HMAC.", hmacSize);
+        return {};
+    }
+
+    if (reuse) {
+        mFreeSlots.pop_back();
+    } else {
+        mSlots.emplace_back();
+    }
 
-    uint8_t *hmacOut = HMAC(EVP_sha256(),
-                            mKey.data(), mKey.size(),
-                            (uint8_t*) &id, ID_SIZE,
-                            hmac.data(), &hmacSize);
+    Slot &slot = mSlots[index];
+    slot.interface = interface;
+    std::copy(hmac.begin(), hmac.begin() + HMAC_SIZE, slot.hmac.begin());
+    slot.identity = identityOf(interface);
+    slot.creator = creator;
 
-    if (hmacOut == nullptr ||
-            hmacOut != hmac.data()) {
-        ALOGE("Generating token failed, got %p.", hmacOut);
-        return { nullptr, {} };
+    lruAppend(index);
+    mTokensByCreator[creator]++;
+    mLiveTokens++;
+
+    return getToken(id, slot.hmac.data(), HMAC_SIZE);
+}
+
+sp<IBase> TokenManager::freeSlot(uint32_t index, std::vector<sp<IBase>> *orphaned) {
+    Slot &slot = mSlots[index];
+    sp<IBase> interface = slot.interface;
+    slot.interface = nullptr;
+
+    lruRemove(index);
+    mLiveTokens--;
+
+    size_t &created = mTokensByCreator[slot.creator];
+    if (--created == 0) {
+        mTokensByCreator.erase(slot.creator);
     }
 
-    // only care about the first HMAC_SIZE bytes of the HMAC
-    const hidl_vec<uint8_t> &token = TokenManager::getToken(id, hmac.data(), hmacSize);
+    if (Store *store = mStores.find(slot.identity)) {
+        // Move the last slot of the store into this one's place.
+        const uint32_t last = store->slots.back();
+        store->slots[slot.storePos] = last;
+        mSlots[last].storePos = slot.storePos;
+        store->slots.pop_back();
+
+        if (store->slots.empty()) {
+            orphaned->push_back(std::move(store->interface));
+            mStores.erase(slot.identity);
+        }
+    }
+    slot.identity = nullptr;
 
-    return { interface, token };
+    if (slot.generation != kMaxGeneration) {
+        slot.generation++;
+        mFreeSlots.push_back(index);
+    } // else retired, see Slot
+
+    return interface;
 }
 
-__attribute__((optnone))
-bool TokenManager::constantTimeCompare(const hidl_vec<uint8_t> &t1, const hidl_vec<uint8_t> &t2) {
-    if (t1.size() != t2.size()) {
-        return false;
+void TokenManager::lruAppend(uint32_t index) {
+    Slot &slot = mSlots[index];
+    slot.lruPrev = mLruTail;
+    slot.lruNext = kNoSlot;
+    if (mLruTail != kNoSlot) {
+        mSlots[mLruTail].lruNext = index;
+    } else {
+        mLruHead = index;
     }
+    mLruTail = index;
+}
 
+void TokenManager::lruRemove(uint32_t index) {
+    Slot &slot = mSlots[index];
+    if (slot.lruPrev != kNoSlot) {
+        mSlots[slot.lruPrev].lruNext = slot.lruNext;
+    } else {
+        mLruHead = slot.lruNext;
+    }
+    if (slot.lruNext != kNoSlot) {
+        mSlots[slot.lruNext].lruPrev = slot.lruPrev;
+    } else {
+        mLruTail = slot.lruPrev;
+    }
+    slot.lruPrev = slot.lruNext = kNoSlot;
+}
+
+__attribute__((optnone))
+bool TokenManager::constantTimeCompare(const uint8_t *b1, const uint8_t *b2, size_t size) {
     uint8_t x = 0;
-    for (size_t i = 0; i < t1.size(); i++) {
-        x |= t1[i] ^ t2[i];
+    for (size_t i = 0; i < size; i++) {
+        x |= b1[i] ^ b2[i];
     }
 
     return x == 0;
 }
 
+uint64_t TokenManager::makeTokenId(uint32_t index, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | index;
+}
+
 uint64_t TokenManager::getTokenId(const hidl_vec<uint8_t> &token) {
-    if (token.size() < ID_SIZE) {
+    if (token.size() != ID_SIZE + HMAC_SIZE) {
         return TOKEN_ID_NONE;
     }
 
     uint64_t id = 0;
     for (size_t i = 0; i < ID_SIZE; i++) {
-        id |= token[i] << i;
+        id |= static_cast<uint64_t>(token[i]) << (8 * i);
     }
 
     return id;
@@ -159,7 +493,7 @@ hidl_vec<uint8_t> TokenManager::getToken(const uint64_t id, const uint8_t *hmac,
     token.resize(ID_SIZE + hmacSize);
 
     for (size_t i = 0; i < ID_SIZE; i++) {
-        token[i] = (id >> i) & 0xFF;
+        token[i] = (id >> (8 * i)) & 0xFF;
     }
 
     for (size_t i = 0; i < hmacSize; i++) {
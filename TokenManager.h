@@ -3,10 +3,20 @@
 
 #include <android/hidl/token/1.0/ITokenManager.h>
 #include <chrono>
+#include <functional>
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
-#include <unordered_map>
+#include <hwbinder/IBinder.h>
+#include <mutex>
+#include <vector>
 #include <array>
+#include <memory>
+#include <openssl/hmac.h>
+
+#include "BinderIdentity.h"
+#include "CallRecorder.h"
+#include "FlatHashMap.h"
+#include "MethodStats.h"
 
 namespace android {
 namespace hidl {
@@ -17,46 +27,234 @@ namespace implementation {
 using ::android::hidl::base::V1_0::IBase;
 using ::android::hidl::token::V1_0::ITokenManager;
 using ::android::hardware::hidl_array;
+using ::android::hardware::hidl_death_recipient;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
 using ::android::hardware::Return;
 using ::android::hardware::Void;
+using ::android::hidl::manager::implementation::CallRecorder;
+using ::android::hidl::manager::implementation::FlatHashMap;
+using ::android::hidl::manager::implementation::identityOf;
+using ::android::hidl::manager::implementation::PointerHash;
 using ::android::sp;
+using ::android::wp;
+
+struct TokenManager : public ITokenManager, hidl_death_recipient {
+    /**
+     * Bounds on the tokens kept; 0 leaves them unbounded.
+     *     maxTokens: once reached, creating a token drops the least
+     *         recently created or fetched one
+     *     maxTokensPerCreator: once a process created this many live
+     *         tokens, its createToken() calls fail
+     */
+    struct Limits {
+        size_t maxTokens;
+        size_t maxTokensPerCreator;
+    };
+
+    /**
+     * getCallingPid identifies the process creating a token, for
+     * maxTokensPerCreator and "--tokens"; without it, every token is
+     * counted against pid 0.
+     *
+     * canDebug tells whether the calling process may see debug() output,
+     * like it may list hwservicemanager; without it, nobody may.
+     */
+    explicit TokenManager(std::function<pid_t()> getCallingPid = nullptr, Limits limits = {},
+                          std::function<bool()> canDebug = nullptr);
+
+    // Number of tokens that can currently be fetched.
+    size_t liveTokens();
 
-struct TokenManager : public ITokenManager {
-    TokenManager();
+    // Records every call served from now on; see ServiceManager::setRecorder().
+    void setRecorder(std::shared_ptr<CallRecorder> recorder);
+
+    /**
+     * The id a token was created with, as recorded for it, or 0 if token
+     * isn't shaped like one of ours. Doesn't check that it is valid.
+     */
+    static uint64_t getTokenId(const hidl_vec<uint8_t> &token);
 
     // Methods from ::android::hidl::token::V1_0::ITokenManager follow.
     Return<void> createToken(const sp<IBase>& store, createToken_cb hidl_cb) override;
     Return<bool> unregister(const hidl_vec<uint8_t> &token) override;
     Return<sp<IBase>> get(const hidl_vec<uint8_t> &token) override;
 
+    // Methods served as hwservicemanager.ext@1.0::ITokenManagerExt follow,
+    // through TokenManagerExt; see interfaces/ext/1.0.
+
+    /**
+     * Creates a token for every interface in stores in one call. tokens[i]
+     * is empty if stores[i] is nullptr or its token couldn't be created.
+     * Returns no tokens at all for more than kMaxCreateTokens stores.
+     */
+    using createTokens_cb = std::function<void(const hidl_vec<hidl_vec<uint8_t>>& tokens)>;
+    Return<void> createTokens(const hidl_vec<sp<IBase>>& stores, createTokens_cb _hidl_cb);
+
+    static constexpr size_t kMaxCreateTokens = 256;
+
+    // Methods from ::android::hidl::base::V1_0::IBase follow.
+
+    /**
+     * Debug commands, e.x. "lshal debug android.hidl.token@1.0::ITokenManager --stats".
+     *     --stats: per-method latencies and event counters since startup
+     *     --tokens: live tokens, in total and per creating pid
+     */
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
+    // Drops every token of an interface whose process died.
+    virtual void serviceDied(uint64_t cookie, const wp<IBase>& who);
+
 private:
+    friend class TokenManagerTest; // tests/TokenManagerTest.cpp
+
+    // Indexes into mStats.
+    enum Method : size_t {
+        kCreateToken,
+        kUnregister,
+        kGet,
+        kCreateTokens,
+    };
+    enum Counter : size_t {
+        kCreateFailed,
+        kTokenMiss,
+        kReclaimed,
+        kEvicted,
+        kQuotaExceeded,
+    };
+
     static constexpr uint64_t ID_SIZE = sizeof(uint64_t) / sizeof(uint8_t);
     static constexpr uint64_t KEY_SIZE = 16;
+    static constexpr uint64_t HMAC_SIZE = 32; // SHA-256
 
     static constexpr uint64_t TOKEN_ID_NONE = 0;
 
-    static bool constantTimeCompare(const hidl_vec<uint8_t> &t1, const hidl_vec<uint8_t> &t2);
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
 
-    static hidl_vec<uint8_t> getToken(const uint64_t id, const uint8_t *hmac, uint64_t hmacSize);
-    static uint64_t getTokenId(const hidl_vec<uint8_t> &token);
+    /**
+     * A token is ID_SIZE bytes of id, little endian, followed by the HMAC
+     * of the id. The id is (generation << 32) | slot index into mSlots.
+     *
+     * A slot's generation is bumped every time it is freed, so tokens for
+     * its previous occupants no longer match. Generations start at 1, so
+     * no id is TOKEN_ID_NONE. A slot whose generation would wrap is never
+     * reused, so an id is never handed out twice.
+     */
+    struct Slot {
+        sp<IBase> interface; // nullptr if the slot is free
+        uint32_t generation = 1;
+        std::array<uint8_t, HMAC_SIZE> hmac{};
 
-    std::array<uint8_t, KEY_SIZE> mKey;
+        // The rest is only meaningful while the slot is occupied.
+        const void *identity = nullptr; // identityOf(interface), key of its Store
+        uint32_t storePos = 0;          // index of this slot in its Store's slots
+        pid_t creator = 0;
+        uint32_t lruPrev = kNoSlot; // neighbours in the LRU list
+        uint32_t lruNext = kNoSlot;
+    };
 
-    struct TokenInterface {
+    /**
+     * The occupied slots holding one interface, compared the way
+     * interfacesEqual() compares them. TokenManager is linked to its death
+     * for as long as there are any.
+     */
+    struct Store {
         sp<IBase> interface;
-        hidl_vec<uint8_t> token; // First eight bytes are tokenId. Remaining bytes are hmac.
+        std::vector<uint32_t> slots;
     };
 
-    TokenInterface generateToken(const sp<IBase> &interface);
+    static constexpr uint32_t kMaxGeneration = UINT32_MAX;
+
+    static bool constantTimeCompare(const uint8_t *b1, const uint8_t *b2, size_t size);
+
+    static hidl_vec<uint8_t> getToken(const uint64_t id, const uint8_t *hmac, uint64_t hmacSize);
+    static uint64_t makeTokenId(uint32_t index, uint32_t generation);
+
+    std::array<uint8_t, KEY_SIZE> mKey;
+
+    /**
+     * HMAC-SHA256 keyed with mKey once, at construction. Every token
+     * rewinds it to the keyed state instead of deriving the key pads
+     * again. Guarded by mLock.
+     */
+    std::unique_ptr<HMAC_CTX, void (*)(HMAC_CTX *)> mHmac;
+    bool mHmacKeyed = false;
+
+    /**
+     * Stores interface in a free slot and returns its token, then evicts
+     * the least recently used token if over mLimits.maxTokens. Returns an
+     * empty token, changing nothing, if creator is over its quota or the
+     * HMAC can't be computed. Interfaces of evicted tokens are moved to
+     * released, for the caller to drop after releasing mLock. If interface
+     * got its first token, it is added to unlinked, for the caller to pass
+     * to linkToDeathOf() after releasing mLock; if the evicted token was
+     * the last of its interface, that one is added to orphaned, see
+     * freeSlot(). Requires mLock.
+     */
+    hidl_vec<uint8_t> createTokenLocked(const sp<IBase> &interface, pid_t creator,
+                                        std::vector<sp<IBase>> *released,
+                                        std::vector<sp<IBase>> *unlinked,
+                                        std::vector<sp<IBase>> *orphaned);
+
+    /**
+     * Links to the death of interfaces. Must not hold mLock. A link may
+     * outlive the tokens it was made for, if they were dropped meanwhile;
+     * serviceDied() ignores interfaces without tokens.
+     */
+    void linkToDeathOf(const std::vector<sp<IBase>> &interfaces);
+
+    /**
+     * Undoes linkToDeathOf() for interfaces. Must not hold mLock. If an
+     * interface got a token again meanwhile, it was linked once more, so
+     * one link is left either way.
+     */
+    void unlinkFromDeathOf(const std::vector<sp<IBase>> &interfaces);
+
+    /**
+     * Stores interface in a free slot and returns its token, or an empty
+     * token (leaving the slot free) if the HMAC can't be computed.
+     * Requires mLock.
+     */
+    hidl_vec<uint8_t> generateToken(const sp<IBase> &interface, pid_t creator);
+
+    // Verifies token, returns its occupied slot or nullptr; requires mLock.
+    Slot *lookupToken(const hidl_vec<uint8_t> &token);
+
+    /**
+     * Empties slot and returns it to mFreeSlots. If it was its interface's
+     * last slot, forgets the interface's Store and adds the interface to
+     * orphaned, for the caller to pass to unlinkFromDeathOf() after
+     * releasing mLock. Returns the interface it held. Requires mLock.
+     */
+    sp<IBase> freeSlot(uint32_t index, std::vector<sp<IBase>> *orphaned);
+
+    // Maintain the LRU list of occupied slots; require mLock.
+    void lruAppend(uint32_t index);
+    void lruRemove(uint32_t index);
+
+    const std::function<pid_t()> mGetCallingPid;
+    const std::function<bool()> mCanDebug;
+    const Limits mLimits;
+
+    std::mutex mLock; // guards mHmac and the members below
+
+    std::vector<Slot> mSlots;
+    std::vector<uint32_t> mFreeSlots; // indexes of free slots, reused last-freed first
+
+    // Occupied slots from least to most recently created or fetched.
+    uint32_t mLruHead = kNoSlot;
+    uint32_t mLruTail = kNoSlot;
+
+    size_t mLiveTokens = 0;
+    FlatHashMap<pid_t, size_t> mTokensByCreator; // live tokens per creator, never 0
+
+    // Keyed by identityOf(); each store's interface keeps its key valid.
+    FlatHashMap<const void *, Store, PointerHash> mStores;
 
-    // verifies token, returns iterator into mMap
-    std::unordered_map<uint64_t, TokenInterface>::const_iterator
-            lookupToken(const hidl_vec<uint8_t> &token);
+    MethodStats mStats; // lock-free, not guarded by mLock
 
-    std::unordered_map<uint64_t, TokenInterface> mMap; // map getTokenId(i.token) -> i
-    uint64_t mTokenIndex = TOKEN_ID_NONE; // last token index
+    std::shared_ptr<CallRecorder> mRecorder;
 };
 
 }  // namespace implementation
@@ -3,14 +3,27 @@
 
 #include "Vintf.h"
 
+#include <sys/stat.h>
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
 #include <android-base/logging.h>
 #include <hidl-util/FQName.h>
 #include <vintf/parse_string.h>
 #include <vintf/VintfObject.h>
 
+#include "FlatHashMap.h"
+
 namespace android {
 namespace hardware {
 
+using ::android::hidl::manager::implementation::FlatHashMap;
+using ::android::hidl::manager::implementation::StringViewHash;
+
 vintf::Transport getTransportFromManifest(
         const FQName &fqName, const std::string &instanceName,
         const vintf::HalManifest *vm) {
@@ -22,7 +35,84 @@ vintf::Transport getTransportFromManifest(
             fqName.name(), instanceName);
 }
 
-vintf::Transport getTransport(const std::string &interfaceName, const std::string &instanceName) {
+namespace {
+
+// Manifest files and fragment directories that VintfObject reads.
+constexpr std::array<const char *, 8> kManifestPaths = {
+    "/system/manifest.xml",
+    "/system/etc/vintf/manifest.xml",
+    "/system/etc/vintf/manifest",
+    "/vendor/manifest.xml",
+    "/vendor/etc/vintf/manifest.xml",
+    "/vendor/etc/vintf/manifest",
+    "/odm/etc/manifest.xml",
+    "/odm/etc/vintf/manifest.xml",
+};
+
+// How often to stat() kManifestPaths for changes.
+constexpr std::chrono::seconds kManifestCheckInterval{1};
+
+// Upper bound on cached transports. Instance names come from callers, so
+// reaching it drops the whole index, like AccessControl's decision cache.
+constexpr size_t kMaxCachedTransports = 4096;
+
+struct FileStamp {
+    bool exists = false;
+    ino_t ino = 0;
+    off_t size = 0;
+    int64_t mtimeNs = 0;
+
+    bool operator==(const FileStamp &other) const {
+        return exists == other.exists && ino == other.ino && size == other.size &&
+                mtimeNs == other.mtimeNs;
+    }
+    bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
+
+using ManifestStamps = std::array<FileStamp, kManifestPaths.size()>;
+
+ManifestStamps stampManifests() {
+    ManifestStamps stamps;
+    for (size_t i = 0; i < kManifestPaths.size(); i++) {
+        struct stat st;
+        if (stat(kManifestPaths[i], &st) != 0) {
+            continue;
+        }
+        stamps[i].exists = true;
+        stamps[i].ino = st.st_ino;
+        stamps[i].size = st.st_size;
+        stamps[i].mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                st.st_mtim.tv_nsec;
+    }
+    return stamps;
+}
+
+/**
+ * Copies of the manifests libvintf parsed. Reloading them through libvintf
+ * frees the ones it handed out before, so lookups never keep its pointers.
+ */
+struct Manifests {
+    std::shared_ptr<const vintf::HalManifest> framework;
+    std::shared_ptr<const vintf::HalManifest> device;
+};
+
+// Callers must not call into VintfObject concurrently, see TransportIndex.
+Manifests loadManifests(bool skipCache) {
+    Manifests manifests;
+    if (const vintf::HalManifest *framework =
+                vintf::VintfObject::GetFrameworkHalManifest(skipCache)) {
+        manifests.framework = std::make_shared<const vintf::HalManifest>(*framework);
+    }
+    if (const vintf::HalManifest *device =
+                vintf::VintfObject::GetDeviceHalManifest(skipCache)) {
+        manifests.device = std::make_shared<const vintf::HalManifest>(*device);
+    }
+    return manifests;
+}
+
+vintf::Transport getTransportUncached(const std::string &interfaceName,
+                                      const std::string &instanceName,
+                                      const Manifests &manifests) {
     FQName fqName(interfaceName);
     if (!fqName.isValid()) {
         LOG(ERROR) << __FUNCTION__ << ": " << interfaceName
@@ -41,12 +131,11 @@ vintf::Transport getTransport(const std::string &interfaceName, const std::strin
     }
 
     vintf::Transport tr = getTransportFromManifest(fqName, instanceName,
-            vintf::VintfObject::GetFrameworkHalManifest());
+            manifests.framework.get());
     if (tr != vintf::Transport::EMPTY) {
         return tr;
     }
-    tr = getTransportFromManifest(fqName, instanceName,
-            vintf::VintfObject::GetDeviceHalManifest());
+    tr = getTransportFromManifest(fqName, instanceName, manifests.device.get());
     if (tr != vintf::Transport::EMPTY) {
         return tr;
     }
@@ -57,5 +146,148 @@ vintf::Transport getTransport(const std::string &interfaceName, const std::strin
     return vintf::Transport::EMPTY;
 }
 
+/**
+ * Transport of every (fqName, instance) asked for so far, including
+ * EMPTY for names neither manifest declares. Dropped when one of the
+ * manifest files changes or it reaches kMaxCachedTransports, so a hit
+ * never parses an FQName or walks a manifest.
+ *
+ * Manifests are parsed by one thread at a time, without holding mLock, and
+ * swapped in once parsed; lookups meanwhile use the previous ones.
+ */
+class TransportIndex {
+public:
+    vintf::Transport get(std::string_view interfaceName, std::string_view instanceName) {
+        checkManifests();
+
+        uint64_t generation;
+        Manifests manifests;
+        {
+            std::shared_lock<std::shared_mutex> lock(mLock);
+            const InstanceMap *instances = mIndex.find(interfaceName);
+            if (instances != nullptr) {
+                const vintf::Transport *transport = instances->find(instanceName);
+                if (transport != nullptr) {
+                    return *transport;
+                }
+            }
+            generation = mGeneration;
+            manifests = mManifests;
+        }
+
+        vintf::Transport transport = getTransportUncached(
+                std::string(interfaceName), std::string(instanceName), manifests);
+
+        std::unique_lock<std::shared_mutex> lock(mLock);
+        if (generation != mGeneration) {
+            // The manifests were reloaded meanwhile; transport comes from the old ones.
+            return transport;
+        }
+        if (mCachedTransports >= kMaxCachedTransports) {
+            mIndex = {};
+            mCachedTransports = 0;
+        }
+        if (mIndex[interfaceName].insert(std::string(instanceName), transport).second) {
+            mCachedTransports++;
+        }
+        return transport;
+    }
+
+    void preload() {
+        checkManifests();
+    }
+
+private:
+    using InstanceMap = FlatHashMap<std::string, vintf::Transport, StringViewHash>;
+
+    bool checkedRecently(std::chrono::steady_clock::time_point now) {
+        std::shared_lock<std::shared_mutex> lock(mLock);
+        return mChecked && now - mLastCheck < kManifestCheckInterval;
+    }
+
+    /**
+     * Loads the manifests the first time, and afterwards reloads them and
+     * drops the index if the manifest files changed.
+     */
+    void checkManifests() {
+        auto now = std::chrono::steady_clock::now();
+        if (checkedRecently(now)) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> reload(mReloadLock, std::defer_lock);
+        if (!reload.try_lock()) {
+            bool loaded;
+            {
+                std::shared_lock<std::shared_mutex> lock(mLock);
+                loaded = mChecked;
+            }
+            if (loaded) {
+                // Another thread is reloading; go on with the current manifests.
+                return;
+            }
+            reload.lock();
+        }
+        if (checkedRecently(now)) {
+            return;
+        }
+
+        // Stamped before parsing, so a manifest that changes while it's being
+        // parsed is reloaded by the next check.
+        ManifestStamps stamps = stampManifests();
+        const bool first = !mLoaded;
+        if (!first && stamps == mStamps) {
+            std::unique_lock<std::shared_mutex> lock(mLock);
+            mLastCheck = now;
+            return;
+        }
+
+        if (!first) {
+            LOG(INFO) << "VINTF manifests changed, dropping cached transports.";
+        }
+        Manifests manifests = loadManifests(!first /* skipCache */);
+        mLoaded = true;
+        mStamps = stamps;
+
+        std::unique_lock<std::shared_mutex> lock(mLock);
+        mChecked = true;
+        mLastCheck = now;
+        mManifests = std::move(manifests);
+        if (!first) {
+            mIndex = {};
+            mCachedTransports = 0;
+            mGeneration++;
+        }
+    }
+
+    // Serializes checkManifests(), the only caller of loadManifests().
+    std::mutex mReloadLock; // guards the members below
+    bool mLoaded = false;
+    ManifestStamps mStamps;
+
+    std::shared_mutex mLock; // guards the members below
+    bool mChecked = false;
+    std::chrono::steady_clock::time_point mLastCheck;
+    Manifests mManifests;
+    uint64_t mGeneration = 0; // bumped whenever the manifests are reloaded
+    size_t mCachedTransports = 0;
+    FlatHashMap<std::string, InstanceMap, StringViewHash> mIndex; // fqName -> instance -> transport
+};
+
+}  // namespace
+
+static TransportIndex &transportIndex() {
+    static TransportIndex index;
+    return index;
+}
+
+vintf::Transport getTransport(std::string_view interfaceName, std::string_view instanceName) {
+    return transportIndex().get(interfaceName, instanceName);
+}
+
+void preloadManifests() {
+    transportIndex().preload();
+}
+
 }  // hardware
 }  // android
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vintf/Transport.h>
 
 namespace android {
@@ -10,8 +11,14 @@ namespace hardware {
 // interfaceName has the format "android.hardware.foo@1.0::IFoo"
 // instanceName is "default", "ashmem", etc.
 // If it starts with "android.hidl.", a static map is looked up instead.
-vintf::Transport getTransport(const std::string &interfaceName,
-                              const std::string &instanceName);
+// Results are cached until the manifest files change. Thread-safe.
+vintf::Transport getTransport(std::string_view interfaceName,
+                              std::string_view instanceName);
+
+// Parses the framework and device manifests so that the first
+// getTransport() calls don't pay for it. Safe to call from any thread,
+// concurrently with getTransport().
+void preloadManifests();
 
 }  // hardware
 }  // android
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <unistd.h>
+
+#include "AccessControlBackend.h"
+
+namespace android {
+
+/**
+ * Access control without SELinux or binder: every call comes from this
+ * process and is allowed (or, with allow = false, denied).
+ */
+class FakeAccessControl : public AccessControlBackend {
+public:
+    explicit FakeAccessControl(bool allow = true) : mAllow(allow) {}
+
+    CallingContext getCallingContext() override {
+        return { true, "u:r:hwservicemanager_benchmark:s0", getpid() };
+    }
+
+    bool canAdd(std::string_view, const CallingContext&) override { return mAllow; }
+    bool canGet(std::string_view, const CallingContext&) override { return mAllow; }
+    bool canList(const CallingContext&) override { return mAllow; }
+
+private:
+    const bool mAllow;
+};
+
+} // namespace android
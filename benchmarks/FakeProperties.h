@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include "PropertyBackend.h"
+
+namespace android {
+
+/**
+ * Properties kept in this object instead of the property service; a
+ * stand-in for init shared by a simulated hwservicemanager and its
+ * simulated clients.
+ */
+class FakeProperties : public PropertyBackend {
+public:
+    std::string get(const std::string& name) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mProperties.find(name);
+        return it == mProperties.end() ? "" : it->second;
+    }
+
+    bool set(const std::string& name, const std::string& value) override {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mProperties[name] = value;
+        }
+        mChanged.notify_all();
+        return true;
+    }
+
+    bool waitForChange(const std::string& name, const std::string& value,
+                       std::chrono::milliseconds timeout) override {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mChanged.wait_for(lock, timeout, [&] {
+            auto it = mProperties.find(name);
+            return (it == mProperties.end() ? "" : it->second) != value;
+        });
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    std::map<std::string, std::string> mProperties;
+};
+
+} // namespace android
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android/hidl/base/1.0/IBase.h>
+
+namespace android {
+
+/**
+ * Local Interface (an IBase) that can be made to "die", notifying whoever
+ * linked to its death. Thread-safe, like a real binder, and like it only
+ * holds weak references to death recipients, so a recipient holding the
+ * interface doesn't keep both alive.
+ */
+template <typename Interface>
+class FakeBinder : public Interface {
+public:
+    using IBase = ::android::hidl::base::V1_0::IBase;
+    using hidl_death_recipient = ::android::hardware::hidl_death_recipient;
+    template <typename T> using Return = ::android::hardware::Return<T>;
+
+    Return<bool> linkToDeath(const sp<hidl_death_recipient>& recipient,
+                             uint64_t cookie) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        mRecipients.push_back({recipient, cookie});
+        return true;
+    }
+
+    Return<bool> unlinkToDeath(const sp<hidl_death_recipient>& recipient) override {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto it = mRecipients.begin(); it != mRecipients.end(); ++it) {
+            if (it->first.unsafe_get() == recipient.get()) {
+                mRecipients.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Delivers serviceDied() to every linked recipient, as binder would.
+    void die() {
+        std::vector<std::pair<wp<hidl_death_recipient>, uint64_t>> recipients;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            recipients = std::move(mRecipients);
+            mRecipients.clear();
+        }
+        for (const auto& recipient : recipients) {
+            if (sp<hidl_death_recipient> alive = recipient.first.promote(); alive != nullptr) {
+                alive->serviceDied(recipient.second, wp<IBase>(this));
+            }
+        }
+    }
+
+private:
+    std::mutex mLock;
+    std::vector<std::pair<wp<hidl_death_recipient>, uint64_t>> mRecipients;
+};
+
+/**
+ * Local IBase with a configurable interface chain.
+ */
+class FakeService : public FakeBinder<::android::hidl::base::V1_0::IBase> {
+public:
+    explicit FakeService(std::vector<std::string> interfaceChain)
+        : mInterfaceChain(std::move(interfaceChain)) {}
+
+    Return<void> interfaceChain(interfaceChain_cb _hidl_cb) override {
+        ::android::hardware::hidl_vec<::android::hardware::hidl_string> chain;
+        chain.resize(mInterfaceChain.size());
+        for (size_t i = 0; i < mInterfaceChain.size(); i++) {
+            chain[i] = mInterfaceChain[i];
+        }
+        _hidl_cb(chain);
+        return ::android::hardware::Void();
+    }
+
+private:
+    std::vector<std::string> mInterfaceChain;
+};
+
+} // namespace android
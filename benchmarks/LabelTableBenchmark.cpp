@@ -0,0 +1,76 @@
+/*
+ * Compares looking up hwservice_contexts through libselinux with the
+ * in-memory LabelTable that AccessControl uses. Run on a device:
+ *   adb shell /data/benchmarktest64/hwservicemanager_benchmark/hwservicemanager_benchmark
+ */
+
+#include <benchmark/benchmark.h>
+#include <selinux/android.h>
+#include <selinux/selinux.h>
+
+#include "LabelTable.h"
+
+using android::LabelTable;
+
+// One name that has its own entry and one that gets the "*" default.
+static const char* kInterfaces[] = {
+    "android.hidl.manager::IServiceManager",
+    "vendor.example.nonexistent::INonexistent",
+};
+
+static void BM_selabel_lookup(benchmark::State& state) {
+    struct selabel_handle* handle = selinux_android_hw_service_context_handle();
+    if (handle == nullptr) {
+        state.SkipWithError("Failed to acquire SELinux handle.");
+        return;
+    }
+    const char* interface = kInterfaces[state.range(0)];
+
+    for (auto _ : state) {
+        char* targetContext = nullptr;
+        if (selabel_lookup(handle, &targetContext, interface, 0) == 0) {
+            freecon(targetContext);
+        }
+    }
+
+    selabel_close(handle);
+}
+BENCHMARK(BM_selabel_lookup)->Arg(0)->Arg(1);
+
+// What AccessControl does: names without an entry of their own still go
+// through selabel_lookup().
+static void BM_LabelTable_lookup(benchmark::State& state) {
+    LabelTable labels;
+    if (!labels.load(LabelTable::defaultPaths())) {
+        state.SkipWithError("Failed to read hwservice_contexts.");
+        return;
+    }
+    struct selabel_handle* handle = selinux_android_hw_service_context_handle();
+    if (handle == nullptr) {
+        state.SkipWithError("Failed to acquire SELinux handle.");
+        return;
+    }
+    const char* interface = kInterfaces[state.range(0)];
+
+    for (auto _ : state) {
+        const std::string* context = labels.lookup(interface);
+        if (context == nullptr) {
+            char* targetContext = nullptr;
+            if (selabel_lookup(handle, &targetContext, interface, 0) == 0) {
+                freecon(targetContext);
+            }
+        }
+        benchmark::DoNotOptimize(context);
+    }
+
+    selabel_close(handle);
+}
+BENCHMARK(BM_LabelTable_lookup)->Arg(0)->Arg(1);
+
+static void BM_LabelTable_load(benchmark::State& state) {
+    for (auto _ : state) {
+        LabelTable labels;
+        benchmark::DoNotOptimize(labels.load(LabelTable::defaultPaths()));
+    }
+}
+BENCHMARK(BM_LabelTable_load);
@@ -0,0 +1,135 @@
+/*
+ * ServiceManager with a fake access control backend and fake services, so
+ * it runs on a host without a binder driver or SELinux policy:
+ *   $ANDROID_HOST_OUT/nativetest64/hwservicemanager_benchmark/hwservicemanager_benchmark
+ *
+ * The first argument of every benchmark is the number of services already
+ * registered.
+ */
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "FakeAccessControl.h"
+#include "FakeService.h"
+#include "ServiceManager.h"
+
+using android::FakeAccessControl;
+using android::FakeService;
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::hidl_vec;
+using android::hidl::manager::implementation::ServiceManager;
+
+static const char* kBaseInterface = "android.hidl.base@1.0::IBase";
+
+static std::string interfaceName(size_t index, size_t minor = 0) {
+    return "vendor.bench.hal" + std::to_string(index) + "@1." + std::to_string(minor) + "::IBench";
+}
+
+// interfaceName(index, depth - 2) down to interfaceName(index, 0), then IBase.
+static std::vector<std::string> interfaceChain(size_t index, size_t depth) {
+    std::vector<std::string> chain;
+    for (size_t minor = depth - 1; minor > 0; minor--) {
+        chain.push_back(interfaceName(index, minor - 1));
+    }
+    chain.push_back(kBaseInterface);
+    return chain;
+}
+
+static sp<ServiceManager> makeManager() {
+    return new ServiceManager(std::make_unique<FakeAccessControl>());
+}
+
+// Registers count services as interfaceName(i)/"default".
+static std::vector<sp<FakeService>> addServices(const sp<ServiceManager>& manager, size_t count) {
+    std::vector<sp<FakeService>> services;
+    for (size_t i = 0; i < count; i++) {
+        services.push_back(new FakeService(interfaceChain(i, 2)));
+        manager->add("default", services.back());
+    }
+    return services;
+}
+
+static void ServiceCounts(benchmark::internal::Benchmark* b) {
+    b->Arg(10)->Arg(100)->Arg(1000);
+}
+
+static void BM_get_hit(benchmark::State& state) {
+    const size_t count = state.range(0);
+    sp<ServiceManager> manager = makeManager();
+    auto services = addServices(manager, count);
+
+    std::vector<hidl_string> names;
+    for (size_t i = 0; i < count; i++) {
+        names.push_back(interfaceName(i));
+    }
+    const hidl_string instance = "default";
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager->get(names[i++ % count], instance));
+    }
+}
+BENCHMARK(BM_get_hit)->Apply(ServiceCounts);
+
+static void BM_get_miss(benchmark::State& state) {
+    sp<ServiceManager> manager = makeManager();
+    auto services = addServices(manager, state.range(0));
+
+    const hidl_string fqName = interfaceName(0);
+    const hidl_string instance = "nonexistent";
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager->get(fqName, instance));
+    }
+}
+BENCHMARK(BM_get_miss)->Apply(ServiceCounts);
+
+// Re-registers one service with an interface chain of range(1) interfaces.
+static void BM_add(benchmark::State& state) {
+    const size_t count = state.range(0);
+    sp<ServiceManager> manager = makeManager();
+    auto services = addServices(manager, count);
+
+    sp<FakeService> service = new FakeService(interfaceChain(count, state.range(1)));
+    const hidl_string instance = "default";
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager->add(instance, service));
+    }
+}
+BENCHMARK(BM_add)->ArgsProduct({{10, 100, 1000}, {2, 4, 8}});
+
+static void BM_list(benchmark::State& state) {
+    sp<ServiceManager> manager = makeManager();
+    auto services = addServices(manager, state.range(0));
+
+    for (auto _ : state) {
+        manager->list([](const hidl_vec<hidl_string>& list) {
+            benchmark::DoNotOptimize(list.size());
+        });
+    }
+}
+BENCHMARK(BM_list)->Apply(ServiceCounts);
+
+// Time from a service dying until it's gone from the registry.
+static void BM_serviceDied(benchmark::State& state) {
+    const size_t count = state.range(0);
+    sp<ServiceManager> manager = makeManager();
+    auto services = addServices(manager, count);
+
+    const hidl_string instance = "default";
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        sp<FakeService> service = new FakeService(interfaceChain(count, 2));
+        manager->add(instance, service);
+        state.ResumeTiming();
+
+        service->die();
+    }
+}
+BENCHMARK(BM_serviceDied)->Apply(ServiceCounts);
@@ -0,0 +1,108 @@
+/*
+ * TokenManager operations with 10, 100 and 1000 tokens outstanding, and
+ * batched token creation. Runs on a host; see ServiceManagerBenchmark.cpp.
+ * Compare the items_per_second (tokens per second) of BM_createToken and
+ * BM_createTokens.
+ */
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "FakeService.h"
+#include "TokenManager.h"
+
+using android::FakeService;
+using android::sp;
+using android::hardware::hidl_vec;
+using android::hidl::base::V1_0::IBase;
+using android::hidl::token::V1_0::implementation::TokenManager;
+
+static hidl_vec<uint8_t> createToken(const sp<TokenManager>& manager, const sp<FakeService>& store) {
+    hidl_vec<uint8_t> token;
+    manager->createToken(store, [&](const hidl_vec<uint8_t>& created) { token = created; });
+    return token;
+}
+
+static std::vector<hidl_vec<uint8_t>> createTokens(const sp<TokenManager>& manager,
+                                                   const sp<FakeService>& store, size_t count) {
+    std::vector<hidl_vec<uint8_t>> tokens;
+    for (size_t i = 0; i < count; i++) {
+        tokens.push_back(createToken(manager, store));
+    }
+    return tokens;
+}
+
+static void TokenCounts(benchmark::internal::Benchmark* b) {
+    b->Arg(10)->Arg(100)->Arg(1000);
+}
+
+// Creates and unregisters one token, so the token count stays put.
+static void BM_createToken(benchmark::State& state) {
+    sp<TokenManager> manager = new TokenManager();
+    sp<FakeService> store = new FakeService({"android.hidl.base@1.0::IBase"});
+    auto tokens = createTokens(manager, store, state.range(0));
+
+    for (auto _ : state) {
+        hidl_vec<uint8_t> token = createToken(manager, store);
+        state.PauseTiming();
+        manager->unregister(token);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_createToken)->Apply(TokenCounts);
+
+// Creates and unregisters a batch of tokens, with 100 outstanding.
+static void BM_createTokens(benchmark::State& state) {
+    sp<TokenManager> manager = new TokenManager();
+    sp<FakeService> store = new FakeService({"android.hidl.base@1.0::IBase"});
+    auto tokens = createTokens(manager, store, 100);
+
+    hidl_vec<sp<IBase>> stores;
+    stores.resize(state.range(0));
+    for (size_t i = 0; i < stores.size(); i++) {
+        stores[i] = store;
+    }
+
+    for (auto _ : state) {
+        hidl_vec<hidl_vec<uint8_t>> created;
+        manager->createTokens(stores, [&](const hidl_vec<hidl_vec<uint8_t>>& batch) {
+            created = batch;
+        });
+        state.PauseTiming();
+        for (const hidl_vec<uint8_t>& token : created) {
+            manager->unregister(token);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * stores.size());
+}
+BENCHMARK(BM_createTokens)->Arg(1)->Arg(16)->Arg(64);
+
+static void BM_getToken(benchmark::State& state) {
+    sp<TokenManager> manager = new TokenManager();
+    sp<FakeService> store = new FakeService({"android.hidl.base@1.0::IBase"});
+    auto tokens = createTokens(manager, store, state.range(0));
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(manager->get(tokens[i++ % tokens.size()]));
+    }
+}
+BENCHMARK(BM_getToken)->Apply(TokenCounts);
+
+static void BM_unregisterToken(benchmark::State& state) {
+    sp<TokenManager> manager = new TokenManager();
+    sp<FakeService> store = new FakeService({"android.hidl.base@1.0::IBase"});
+    auto tokens = createTokens(manager, store, state.range(0));
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        hidl_vec<uint8_t> token = createToken(manager, store);
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(manager->unregister(token));
+    }
+}
+BENCHMARK(BM_unregisterToken)->Apply(TokenCounts);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace android {
+
+/**
+ * Reads, writes and waits on system properties.
+ *
+ * SystemProperties implements it with the property service. Host-side
+ * tools inject their own, so restarts of hwservicemanager can be played
+ * out in one process without init.
+ *
+ * All methods may be called from several threads at once.
+ */
+class PropertyBackend {
+public:
+    virtual ~PropertyBackend() = default;
+
+    // Returns "" if the property isn't set.
+    virtual std::string get(const std::string& name) = 0;
+    virtual bool set(const std::string& name, const std::string& value) = 0;
+
+    /**
+     * Blocks until the property no longer reads as value, or timeout
+     * passes. Returns true if it changed.
+     */
+    virtual bool waitForChange(const std::string& name, const std::string& value,
+                               std::chrono::milliseconds timeout) = 0;
+};
+
+} // namespace android
@@ -0,0 +1,219 @@
+#define LOG_TAG "hwservicemanager"
+
+#include "RestartRecovery.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <hidl/HidlSupport.h>
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hardware::interfacesEqual;
+
+const char* const kRestartEpochProperty = "hwservicemanager.restart_epoch";
+
+uint64_t readRestartEpoch(PropertyBackend& properties) {
+    uint64_t epoch = 0;
+    if (!::android::base::ParseUint(properties.get(kRestartEpochProperty), &epoch)) {
+        return 0;
+    }
+    return epoch;
+}
+
+uint64_t publishRestartEpoch(PropertyBackend& properties) {
+    // The property service outlives hwservicemanager, so the previous
+    // instance's epoch is still there after a restart.
+    const uint64_t epoch = readRestartEpoch(properties) + 1;
+    if (!properties.set(kRestartEpochProperty, std::to_string(epoch))) {
+        return 0;
+    }
+    return epoch;
+}
+
+RegistrationKeeper::RegistrationKeeper(std::shared_ptr<PropertyBackend> properties,
+                                       ManagerGetter getManager,
+                                       std::chrono::milliseconds watchTimeout)
+    : mProperties(std::move(properties)),
+      mGetManager(std::move(getManager)),
+      mWatchTimeout(watchTimeout) {}
+
+RegistrationKeeper::~RegistrationKeeper() {
+    mStopping = true;
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+bool RegistrationKeeper::add(const std::string& name, const sp<IBase>& service) {
+    // Read first: if the manager restarts after this, the registration
+    // looks older than the new epoch and is added again.
+    const uint64_t epoch = readRestartEpoch(*mProperties);
+    if (!addToManager(name, service)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mRegistrations.push_back({"", name, service, nullptr, epoch});
+    return true;
+}
+
+bool RegistrationKeeper::registerForNotifications(const std::string& fqName,
+                                                  const std::string& name,
+                                                  const sp<IServiceNotification>& listener) {
+    // Read first, like in add().
+    const uint64_t epoch = readRestartEpoch(*mProperties);
+    if (!registerWithManager(fqName, name, listener)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mRegistrations.push_back({fqName, name, nullptr, listener, epoch});
+    return true;
+}
+
+void RegistrationKeeper::forget(const sp<IBase>& service) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto it = mRegistrations.begin(); it != mRegistrations.end();) {
+        const sp<IBase> registered =
+                it->listener != nullptr ? sp<IBase>(it->listener) : it->service;
+        if (interfacesEqual(registered, service)) {
+            it = mRegistrations.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RegistrationKeeper::start() {
+    if (!mThread.joinable()) {
+        mThread = std::thread([this] { watch(); });
+    }
+}
+
+bool RegistrationKeeper::reregisterIfRestarted() {
+    const uint64_t epoch = readRestartEpoch(*mProperties);
+
+    std::vector<Registration> stale;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (const Registration& registration : mRegistrations) {
+            if (registration.epoch < epoch) {
+                stale.push_back(registration);
+            }
+        }
+    }
+    if (stale.empty()) {
+        return true;
+    }
+
+    LOG(INFO) << "hwservicemanager restarted (epoch " << epoch << "), restoring "
+              << stale.size() << " registrations.";
+
+    bool allAdded = true;
+    for (Registration& registration : stale) {
+        if (restore(registration)) {
+            registration.epoch = epoch;
+        } else {
+            allAdded = false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    for (Registration& registration : mRegistrations) {
+        for (const Registration& added : stale) {
+            if (added.epoch == epoch && sameRegistration(registration, added)) {
+                registration.epoch = std::max(registration.epoch, epoch);
+            }
+        }
+    }
+    return allAdded;
+}
+
+bool RegistrationKeeper::addToManager(const std::string& name, const sp<IBase>& service) {
+    sp<::android::hidl::manager::V1_0::IServiceManager> manager = mGetManager();
+    if (manager == nullptr) {
+        LOG(ERROR) << "Cannot add " << name << ": no hwservicemanager.";
+        return false;
+    }
+    if (!manager->add(name, service).withDefault(false)) {
+        LOG(ERROR) << "hwservicemanager refused to add " << name << ".";
+        return false;
+    }
+    return true;
+}
+
+bool RegistrationKeeper::registerWithManager(const std::string& fqName, const std::string& name,
+                                             const sp<IServiceNotification>& listener) {
+    sp<::android::hidl::manager::V1_0::IServiceManager> manager = mGetManager();
+    if (manager == nullptr) {
+        LOG(ERROR) << "Cannot register a listener for " << fqName << "/" << name
+                   << ": no hwservicemanager.";
+        return false;
+    }
+    if (!manager->registerForNotifications(fqName, name, listener).withDefault(false)) {
+        LOG(ERROR) << "hwservicemanager refused to register a listener for " << fqName << "/"
+                   << name << ".";
+        return false;
+    }
+    return true;
+}
+
+bool RegistrationKeeper::restore(const Registration& registration) {
+    if (registration.listener != nullptr) {
+        return registerWithManager(registration.fqName, registration.name,
+                                   registration.listener);
+    }
+    return addToManager(registration.name, registration.service);
+}
+
+bool RegistrationKeeper::sameRegistration(const Registration& a, const Registration& b) {
+    return a.fqName == b.fqName && a.name == b.name &&
+            interfacesEqual(a.service, b.service) && interfacesEqual(a.listener, b.listener);
+}
+
+void RegistrationKeeper::watch() {
+    pthread_setname_np(pthread_self(), "HwRegKeeper");
+
+    std::string seen = mProperties->get(kRestartEpochProperty);
+    bool upToDate = reregisterIfRestarted();
+    while (!mStopping) {
+        waitForEpochChange(seen, upToDate ? mWatchTimeout : kRetryInterval);
+        if (mStopping) {
+            break;
+        }
+        seen = mProperties->get(kRestartEpochProperty);
+        upToDate = reregisterIfRestarted();
+    }
+}
+
+void RegistrationKeeper::waitForEpochChange(const std::string& seen,
+                                            std::chrono::milliseconds timeout) {
+    using std::chrono::steady_clock;
+
+    // A property wait can't be interrupted, so check mStopping between slices.
+    const steady_clock::time_point deadline = steady_clock::now() + timeout;
+    while (!mStopping) {
+        const steady_clock::time_point now = steady_clock::now();
+        if (now >= deadline) {
+            return;
+        }
+        const std::chrono::milliseconds slice = std::min(
+                kStopCheckInterval,
+                std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+        if (mProperties->waitForChange(kRestartEpochProperty, seen, slice)) {
+            return;
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
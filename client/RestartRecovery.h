@@ -0,0 +1,152 @@
+#ifndef ANDROID_HARDWARE_MANAGER_RESTARTRECOVERY_H
+#define ANDROID_HARDWARE_MANAGER_RESTARTRECOVERY_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android/hidl/manager/1.0/IServiceManager.h>
+#include <android/hidl/manager/1.0/IServiceNotification.h>
+
+#include "PropertyBackend.h"
+
+namespace android {
+namespace hidl {
+namespace manager {
+namespace implementation {
+
+using ::android::hidl::base::V1_0::IBase;
+using ::android::hidl::manager::V1_0::IServiceNotification;
+using ::android::sp;
+
+/**
+ * hwservicemanager keeps its registry in memory only. Each time it starts,
+ * once it serves calls, it publishes a new restart epoch in this property.
+ * Processes that registered services with an earlier instance add them
+ * again when the epoch changes, see RegistrationKeeper, so a restart of
+ * hwservicemanager doesn't need a restart of every HAL. Init still
+ * restarts the HAL classes with it unless the device sets
+ * ro.hwservicemanager.restart_recovery=true; see hwservicemanager.rc. Both
+ * properties are labelled in sepolicy/property_contexts.
+ */
+extern const char* const kRestartEpochProperty;
+
+// The published epoch, or 0 if no hwservicemanager has published one yet.
+uint64_t readRestartEpoch(PropertyBackend& properties);
+
+/**
+ * Publishes the epoch after the current one; called by hwservicemanager
+ * once it is ready. Returns the new epoch, or 0 if it couldn't be set.
+ */
+uint64_t publishRestartEpoch(PropertyBackend& properties);
+
+/**
+ * Client side of restart recovery: remembers the services a process added
+ * and the listeners it registered, and adds or registers them again with
+ * every hwservicemanager that publishes a newer restart epoch. HALs use
+ * add() where they would call registerAsService(), and
+ * registerForNotifications() where they would call the manager's, then
+ * start().
+ */
+class RegistrationKeeper {
+public:
+    using ManagerGetter = std::function<sp<::android::hidl::manager::V1_0::IServiceManager>()>;
+
+    // How often the epoch is checked again without having seen it change.
+    static constexpr std::chrono::milliseconds kDefaultWatchTimeout{std::chrono::minutes(10)};
+    // How soon registrations that failed to be added again are retried.
+    static constexpr std::chrono::milliseconds kRetryInterval{std::chrono::seconds(1)};
+    /**
+     * The watcher thread waits for the epoch in slices at most this long
+     * and stops after the slice the keeper is destroyed in, so the
+     * destructor never blocks for longer.
+     */
+    static constexpr std::chrono::milliseconds kStopCheckInterval{std::chrono::seconds(1)};
+
+    /**
+     * getManager returns the hwservicemanager currently running, or
+     * nullptr if there is none.
+     */
+    RegistrationKeeper(std::shared_ptr<PropertyBackend> properties, ManagerGetter getManager,
+                       std::chrono::milliseconds watchTimeout = kDefaultWatchTimeout);
+    ~RegistrationKeeper();
+
+    RegistrationKeeper(const RegistrationKeeper&) = delete;
+    RegistrationKeeper& operator=(const RegistrationKeeper&) = delete;
+
+    /**
+     * Adds service under name to the current hwservicemanager and, if that
+     * succeeded, keeps adding it to every later one.
+     */
+    bool add(const std::string& name, const sp<IBase>& service);
+
+    /**
+     * Registers listener for fqName/name with the current hwservicemanager
+     * and, if that succeeded, with every later one. Like any new listener,
+     * it is then told about every instance that is already registered
+     * there, so after a restart it hears again, as preexisting, about
+     * services it was told about before.
+     */
+    bool registerForNotifications(const std::string& fqName, const std::string& name,
+                                  const sp<IServiceNotification>& listener);
+
+    /**
+     * Stops adding service, or registering it as a listener, again. It
+     * stays registered with the current hwservicemanager until it dies.
+     */
+    void forget(const sp<IBase>& service);
+
+    // Starts a thread that calls reregisterIfRestarted() whenever the epoch changes.
+    void start();
+
+    /**
+     * Adds every service and registers every listener that was added or
+     * registered under an older epoch with the current hwservicemanager.
+     * Returns false if some of them couldn't be; they are tried again on
+     * the next call.
+     */
+    bool reregisterIfRestarted();
+
+private:
+    // A service added, or a listener registered, with hwservicemanager.
+    struct Registration {
+        std::string fqName; // only for listeners
+        std::string name;
+        sp<IBase> service;
+        sp<IServiceNotification> listener;
+        uint64_t epoch; // read before the call that succeeded
+    };
+
+    bool addToManager(const std::string& name, const sp<IBase>& service);
+    bool registerWithManager(const std::string& fqName, const std::string& name,
+                             const sp<IServiceNotification>& listener);
+    // Adds or registers registration with the current hwservicemanager.
+    bool restore(const Registration& registration);
+    static bool sameRegistration(const Registration& a, const Registration& b);
+    void watch();
+
+    // Returns once the epoch no longer reads as seen, timeout passed or mStopping is set.
+    void waitForEpochChange(const std::string& seen, std::chrono::milliseconds timeout);
+
+    const std::shared_ptr<PropertyBackend> mProperties;
+    const ManagerGetter mGetManager;
+    const std::chrono::milliseconds mWatchTimeout;
+
+    std::mutex mLock; // guards mRegistrations
+    std::vector<Registration> mRegistrations;
+
+    std::atomic<bool> mStopping{false};
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace manager
+}  // namespace hidl
+}  // namespace android
+
+#endif // ANDROID_HARDWARE_MANAGER_RESTARTRECOVERY_H
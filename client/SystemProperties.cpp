@@ -0,0 +1,64 @@
+#include "SystemProperties.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <android-base/properties.h>
+
+#if defined(__BIONIC__)
+#include <sys/system_properties.h>
+#endif
+
+namespace android {
+
+using std::chrono::steady_clock;
+
+#if !defined(__BIONIC__)
+static constexpr std::chrono::milliseconds kPollInterval{50};
+#endif
+
+std::string SystemProperties::get(const std::string& name) {
+    return base::GetProperty(name, "");
+}
+
+bool SystemProperties::set(const std::string& name, const std::string& value) {
+    return base::SetProperty(name, value);
+}
+
+bool SystemProperties::waitForChange(const std::string& name, const std::string& value,
+                                     std::chrono::milliseconds timeout) {
+    const steady_clock::time_point deadline = steady_clock::now() + timeout;
+    while (true) {
+#if defined(__BIONIC__)
+        // Taken before reading the value, so a change in between ends the
+        // wait below at once. Until the property exists, any property
+        // change wakes it.
+        const prop_info* info = __system_property_find(name.c_str());
+        const uint32_t serial = info != nullptr ? __system_property_serial(info)
+                                                : __system_property_area_serial();
+#endif
+        if (get(name) != value) {
+            return true;
+        }
+
+        const steady_clock::time_point now = steady_clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+
+#if defined(__BIONIC__)
+        const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+        timespec relative = {
+            .tv_sec = static_cast<time_t>(left.count() / 1000000000),
+            .tv_nsec = static_cast<long>(left.count() % 1000000000),
+        };
+        uint32_t newSerial;
+        __system_property_wait(info, serial, &newSerial, &relative);
+#else
+        std::this_thread::sleep_for(std::min<steady_clock::duration>(deadline - now,
+                                                                     kPollInterval));
+#endif
+    }
+}
+
+} // namespace android
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "PropertyBackend.h"
+
+namespace android {
+
+/**
+ * The property service. On a host, where libbase keeps properties in
+ * process, waitForChange() polls.
+ */
+class SystemProperties : public PropertyBackend {
+public:
+    std::string get(const std::string& name) override;
+    bool set(const std::string& name, const std::string& value) override;
+    bool waitForChange(const std::string& name, const std::string& value,
+                       std::chrono::milliseconds timeout) override;
+};
+
+} // namespace android
@@ -5,19 +5,31 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <functional>
+#include <thread>
+
 #include <android/hidl/manager/1.0/BnHwServiceManager.h>
 #include <android/hidl/manager/1.0/IServiceManager.h>
 #include <android/hidl/token/1.0/ITokenManager.h>
+#include <android-base/properties.h>
 #include <cutils/properties.h>
 #include <hidl/Status.h>
 #include <hwbinder/binder_kernel.h>
 #include <hwbinder/IPCThreadState.h>
+#include <hwbinder/ProcessState.h>
 #include <utils/Errors.h>
 #include <utils/Looper.h>
 #include <utils/StrongPointer.h>
 
+#include "AccessControl.h"
+#include "CallRecorder.h"
+#include "Extensions.h"
+#include "RestartRecovery.h"
 #include "ServiceManager.h"
+#include "SystemProperties.h"
 #include "TokenManager.h"
+#include "Vintf.h"
 
 // libutils:
 using android::BAD_TYPE;
@@ -29,6 +41,7 @@ using android::status_t;
 
 // libhwbinder:
 using android::hardware::IPCThreadState;
+using android::hardware::ProcessState;
 
 // libhidl
 using android::hardware::configureRpcThreadpool;
@@ -40,13 +53,76 @@ using android::hardware::setRequestingSid;
 using android::hidl::manager::V1_0::BnHwServiceManager;
 using android::hidl::manager::V1_1::IServiceManager;
 using android::hidl::token::V1_0::ITokenManager;
+using hwservicemanager::ext::V1_0::IServiceManagerExt;
+using hwservicemanager::ext::V1_0::ITokenManagerExt;
+
+using std::chrono::steady_clock;
 
 // implementations
+using android::AccessControl;
+using android::SystemProperties;
+using android::hidl::manager::implementation::CallRecorder;
+using android::hidl::manager::implementation::ServiceManagerExt;
+using android::hidl::manager::implementation::TokenManagerExt;
+using android::hidl::manager::implementation::publishRestartEpoch;
 using android::hidl::manager::implementation::ServiceManager;
 using android::hidl::token::V1_0::implementation::TokenManager;
 
 static std::string serviceName = "default";
 
+// Whether the VINTF manifest declares fqName/default, so clients can get it;
+// see hwservicemanager.ext.xml.
+static bool isDeclared(const char* fqName) {
+    return android::hardware::getTransport(fqName, serviceName) ==
+            android::vintf::Transport::HWBINDER;
+}
+
+// Number of threads serving hwbinder calls, including the looper thread.
+static const char* kThreadsProperty = "ro.hwservicemanager.threads";
+static constexpr size_t kMaxThreads = 16;
+
+// Optional bounds on the tokens ITokenManager keeps, see TokenManager::Limits.
+static const char* kMaxTokensProperty = "ro.hwservicemanager.max_tokens";
+static const char* kMaxTokensPerPidProperty = "ro.hwservicemanager.max_tokens_per_pid";
+
+// On debuggable builds, if set when hwservicemanager starts, every call it
+// serves is recorded for hwservicemanager_replay, to the file of this name
+// in kTraceDir. Traces show who calls what, so nowhere else.
+static const char* kTraceFileProperty = "hwservicemanager.trace_file";
+static const char* kTraceDir = "/data/misc/hwservicemanager/";
+
+static int64_t millisSince(steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            steady_clock::now() - start).count();
+}
+
+/**
+ * Runs one startup step on its own thread and logs how long it took.
+ * main() joins it before setting hwservicemanager.ready, so the first HAL
+ * calls find the step done without waiting for it on the main thread. It
+ * is also joined when it goes out of scope, so returning early never
+ * destroys a joinable thread; declare it after whatever the step uses.
+ */
+class Warmup {
+public:
+    Warmup(const char* phase, std::function<void()> warmup)
+        : mThread([phase, warmup = std::move(warmup)] {
+              const steady_clock::time_point start = steady_clock::now();
+              warmup();
+              ALOGI("Startup: %s took %" PRId64 " ms.", phase, millisSince(start));
+          }) {}
+    ~Warmup() { join(); }
+
+    void join() {
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+private:
+    std::thread mThread;
+};
+
 class BinderCallback : public LooperCallback {
 public:
     BinderCallback() {}
@@ -59,17 +135,76 @@ public:
 };
 
 int main() {
-    configureRpcThreadpool(1, true /* callerWillJoin */);
+    const steady_clock::time_point startTime = steady_clock::now();
+
+    // Both only read files; they run while the binder context manager is
+    // set up below. The manager's own checks wait for them if they get
+    // there first.
+    Warmup manifestWarmup("VINTF manifests", android::hardware::preloadManifests);
+
+    size_t threads = android::base::GetUintProperty<size_t>(kThreadsProperty, 1, kMaxThreads);
+    if (threads == 0) {
+        threads = 1;
+    }
+    configureRpcThreadpool(threads, true /* callerWillJoin */);
 
-    sp<ServiceManager> manager = new ServiceManager();
+    auto acl = std::make_unique<AccessControl>();
+    AccessControl* accessControl = acl.get(); // owned by manager, which is never freed
+
+    // One thread (the looper) never parks in waitForService().
+    sp<ServiceManager> manager = new ServiceManager(std::move(acl), threads - 1 /* maxWaiters */);
 //    setRequestingSid(manager, true); // HACKED
 
+    // After manager, so it is joined before accessControl could go away.
+    Warmup labelWarmup("hwservice_contexts", [accessControl] {
+        accessControl->preloadLabels();
+    });
+
+    TokenManager::Limits tokenLimits = {
+        .maxTokens = android::base::GetUintProperty<size_t>(kMaxTokensProperty, 0),
+        .maxTokensPerCreator = android::base::GetUintProperty<size_t>(kMaxTokensPerPidProperty, 0),
+    };
+    TokenManager *tokenManager = new TokenManager([] {
+        return IPCThreadState::self()->getCallingPid();
+    }, tokenLimits, [accessControl] {
+        return accessControl->canList(accessControl->getCallingContext());
+    });
+
+    std::string traceFile = android::base::GetProperty(kTraceFileProperty, "");
+    if (!traceFile.empty() && !android::base::GetBoolProperty("ro.debuggable", false)) {
+        ALOGW("Ignoring %s, calls are only recorded on debuggable builds.", kTraceFileProperty);
+    } else if (traceFile.find('/') != std::string::npos || traceFile == "." ||
+               traceFile == "..") {
+        ALOGE("Ignoring %s, %s is not a file name.", kTraceFileProperty, traceFile.c_str());
+    } else if (!traceFile.empty()) {
+        std::string tracePath = kTraceDir + traceFile;
+        std::shared_ptr<CallRecorder> recorder = CallRecorder::open(tracePath, [accessControl] {
+            return accessControl->getCallingContext();
+        });
+        if (recorder != nullptr) {
+            ALOGI("Recording calls to %s.", tracePath.c_str());
+            manager->setRecorder(recorder);
+            tokenManager->setRecorder(recorder);
+        }
+    }
+
+    // Added first, so the android.hidl.base@1.0::IBase entry still ends up
+    // with the last of the two below. Devices that don't ship the manifest
+    // fragment and hwservice_contexts entries for them go without.
+    if (isDeclared(IServiceManagerExt::descriptor) &&
+            !manager->add(serviceName, new ServiceManagerExt(manager))) {
+        ALOGE("Failed to register IServiceManagerExt with hwservicemanager.");
+    }
+
+    if (isDeclared(ITokenManagerExt::descriptor) &&
+            !manager->add(serviceName, new TokenManagerExt(tokenManager))) {
+        ALOGE("Failed to register ITokenManagerExt with hwservicemanager.");
+    }
+
     if (!manager->add(serviceName, manager)) {
         ALOGE("Failed to register hwservicemanager with itself.");
     }
 
-    TokenManager *tokenManager = new TokenManager();
-
     if (!manager->add(serviceName, tokenManager)) {
         ALOGE("Failed to register ITokenManager with hwservicemanager.");
     }
@@ -124,12 +259,37 @@ int main() {
         ALOGE("BINDER_SET_INHERIT_FIFO_PRIO failed with error %d\n", rc);
     }
 
+    // The looper thread below serves calls itself. Any other threads are
+    // spawned by the binder driver as calls come in; reads run on them
+    // concurrently, mutations are serialized inside ServiceManager.
+    if (threads > 1) {
+        ProcessState::self()->startThreadPool();
+    }
+
+    ALOGI("Startup: binder context manager set up after %" PRId64 " ms.", millisSince(startTime));
+
+    manifestWarmup.join();
+    labelWarmup.join();
+
+    ALOGI("Startup: ready after %" PRId64 " ms.", millisSince(startTime));
+
     rc = property_set("hwservicemanager.ready", "true");
     if (rc) {
         ALOGE("Failed to set \"hwservicemanager.ready\" (error %d). "\
               "HAL services will not start!\n", rc);
     }
 
+    // HALs that registered with a previous instance of hwservicemanager
+    // (before it crashed) see the new epoch and add their services again.
+    SystemProperties properties;
+    uint64_t epoch = publishRestartEpoch(properties);
+    if (epoch == 0) {
+        ALOGE("Failed to publish the restart epoch. HALs will not re-register "
+              "after a restart!");
+    } else if (epoch > 1) {
+        ALOGI("Restarted, published restart epoch %" PRIu64 ".", epoch);
+    }
+
     while (true) {
         looper->pollAll(-1 /* timeoutMillis */);
     }
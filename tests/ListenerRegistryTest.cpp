@@ -0,0 +1,101 @@
+/*
+ * ListenerRegistry: subscriptions of one listener, and the three ways of
+ * removing them.
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ListenerRegistry.h"
+
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::Return;
+using android::hardware::Void;
+using android::hidl::manager::implementation::InternedName;
+using android::hidl::manager::implementation::ListenerRegistry;
+using android::hidl::manager::implementation::NamePool;
+using android::hidl::manager::V1_0::IServiceNotification;
+
+namespace {
+
+class Listener : public IServiceNotification {
+public:
+    Return<void> onRegistration(const hidl_string&, const hidl_string&, bool) override {
+        return Void();
+    }
+};
+
+class ListenerRegistryTest : public ::testing::Test {
+protected:
+    ListenerRegistry::Subscription package(const char* fqName) {
+        return {mNames.intern(fqName), InternedName()};
+    }
+
+    ListenerRegistry::Subscription instance(const char* fqName, const char* name) {
+        return {mNames.intern(fqName), mNames.intern(name)};
+    }
+
+    NamePool mNames;
+    ListenerRegistry mRegistry;
+    sp<Listener> mListener = new Listener();
+};
+
+TEST_F(ListenerRegistryTest, ContainsExactlyWhatWasAdded) {
+    mRegistry.add(mListener, instance("a@1.0::IA", "default"));
+
+    EXPECT_TRUE(mRegistry.contains(mListener, instance("a@1.0::IA", "default")));
+    EXPECT_FALSE(mRegistry.contains(mListener, instance("a@1.0::IA", "other")));
+    EXPECT_FALSE(mRegistry.contains(mListener, package("a@1.0::IA")));
+    EXPECT_FALSE(mRegistry.contains(new Listener(), instance("a@1.0::IA", "default")));
+}
+
+TEST_F(ListenerRegistryTest, RemovesOneInstance) {
+    mRegistry.add(mListener, instance("a@1.0::IA", "default"));
+    mRegistry.add(mListener, instance("a@1.0::IA", "other"));
+
+    auto removed = mRegistry.remove(mListener, mNames.intern("a@1.0::IA"),
+                                    mNames.intern("default"));
+    ASSERT_EQ(1u, removed.size());
+    EXPECT_EQ("default", removed[0].instanceName.str());
+
+    EXPECT_FALSE(mRegistry.contains(mListener, instance("a@1.0::IA", "default")));
+    EXPECT_TRUE(mRegistry.contains(mListener, instance("a@1.0::IA", "other")));
+}
+
+TEST_F(ListenerRegistryTest, RemovesAnInterfaceWithItsInstances) {
+    mRegistry.add(mListener, package("a@1.0::IA"));
+    mRegistry.add(mListener, instance("a@1.0::IA", "default"));
+    mRegistry.add(mListener, instance("b@1.0::IB", "default"));
+
+    auto removed = mRegistry.remove(mListener, mNames.intern("a@1.0::IA"));
+    EXPECT_EQ(2u, removed.size());
+
+    EXPECT_FALSE(mRegistry.contains(mListener, package("a@1.0::IA")));
+    EXPECT_FALSE(mRegistry.contains(mListener, instance("a@1.0::IA", "default")));
+    EXPECT_TRUE(mRegistry.contains(mListener, instance("b@1.0::IB", "default")));
+}
+
+TEST_F(ListenerRegistryTest, RemovesEverything) {
+    mRegistry.add(mListener, package("a@1.0::IA"));
+    mRegistry.add(mListener, instance("b@1.0::IB", "default"));
+    sp<Listener> other = new Listener();
+    mRegistry.add(other, package("a@1.0::IA"));
+
+    EXPECT_EQ(2u, mRegistry.remove(mListener).size());
+    EXPECT_TRUE(mRegistry.remove(mListener).empty());
+
+    EXPECT_FALSE(mRegistry.contains(mListener, package("a@1.0::IA")));
+    EXPECT_TRUE(mRegistry.contains(other, package("a@1.0::IA")));
+}
+
+TEST_F(ListenerRegistryTest, RemovesNothingForUnknownListeners) {
+    mRegistry.add(mListener, package("a@1.0::IA"));
+
+    EXPECT_TRUE(mRegistry.remove(new Listener()).empty());
+    EXPECT_TRUE(mRegistry.remove(nullptr).empty());
+    EXPECT_TRUE(mRegistry.contains(mListener, package("a@1.0::IA")));
+}
+
+}  // namespace
@@ -0,0 +1,48 @@
+/*
+ * NamePool: interning, lookups that don't intern, and the byte cap.
+ */
+
+#include <gtest/gtest.h>
+
+#include "NamePool.h"
+
+using android::hidl::manager::implementation::InternedName;
+using android::hidl::manager::implementation::NamePool;
+
+namespace {
+
+TEST(NamePoolTest, InternsEachNameOnce) {
+    NamePool names;
+    InternedName a = names.intern("a@1.0::IA");
+    EXPECT_EQ(a, names.intern(std::string("a@1.0::IA")));
+    EXPECT_NE(a, names.intern("default"));
+    EXPECT_EQ("a@1.0::IA", a.str());
+    EXPECT_EQ(2u, names.size());
+    EXPECT_EQ(std::string_view("a@1.0::IA").size() + std::string_view("default").size(),
+              names.bytes());
+}
+
+TEST(NamePoolTest, FindNeverInterns) {
+    NamePool names;
+    EXPECT_FALSE(names.find("a@1.0::IA"));
+    EXPECT_EQ(0u, names.size());
+
+    InternedName a = names.intern("a@1.0::IA");
+    EXPECT_EQ(a, names.find("a@1.0::IA"));
+}
+
+TEST(NamePoolTest, StopsTakingNewNamesAtMaxBytes) {
+    NamePool names(10 /* maxBytes */);
+    InternedName first = names.intern("12345");
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(names.intern("67890"));
+
+    EXPECT_FALSE(names.intern("x"));
+    EXPECT_FALSE(names.find("x"));
+    EXPECT_EQ(10u, names.bytes());
+
+    // Names already in the pool are still found and interned.
+    EXPECT_EQ(first, names.intern("12345"));
+}
+
+}  // namespace
@@ -0,0 +1,137 @@
+/*
+ * NotificationQueue: per-listener ordering, dedupe of queued notifications
+ * and batched delivery.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "NotificationQueue.h"
+
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::hidl_vec;
+using android::hardware::Return;
+using android::hardware::Void;
+using android::hidl::manager::implementation::NamePool;
+using android::hidl::manager::implementation::NotificationQueue;
+using android::hidl::manager::V1_0::IServiceNotification;
+using hwservicemanager::ext::V1_0::IServiceNotificationBatch;
+using hwservicemanager::ext::V1_0::Registration;
+
+namespace {
+
+// Records the instance names it was notified of.
+template <typename Interface>
+class Recorder : public Interface {
+public:
+    Return<void> onRegistration(const hidl_string&, const hidl_string& name, bool) override {
+        record({name});
+        return Void();
+    }
+
+    // Waits until count notifications arrived (or 10s passed), returns them all.
+    std::vector<std::string> waitFor(size_t count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mChanged.wait_for(lock, std::chrono::seconds(10), [&] { return mNames.size() >= count; });
+        return mNames;
+    }
+
+    size_t calls() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mCalls;
+    }
+
+protected:
+    void record(const std::vector<std::string>& names) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mNames.insert(mNames.end(), names.begin(), names.end());
+            mCalls++;
+        }
+        mChanged.notify_all();
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    std::vector<std::string> mNames;
+    size_t mCalls = 0;
+};
+
+using Listener = Recorder<IServiceNotification>;
+
+class BatchListener : public Recorder<IServiceNotificationBatch> {
+public:
+    Return<void> onRegistrations(const hidl_vec<Registration>& registrations) override {
+        std::vector<std::string> names;
+        for (const Registration& registration : registrations) {
+            names.push_back(registration.instanceName);
+        }
+        record(names);
+        return Void();
+    }
+};
+
+class NotificationQueueTest : public ::testing::Test {
+protected:
+    // Queues a notification of a@1.0::IA/name's registration-th registration.
+    void enqueue(const sp<IServiceNotification>& listener, const char* name,
+                 uint64_t registration) {
+        mQueue.enqueue(listener, mNames.intern("a@1.0::IA"), mNames.intern(name),
+                       registration, false /* preexisting */);
+    }
+
+    NamePool mNames;
+    NotificationQueue mQueue{[](const sp<IServiceNotification>&, NotificationQueue::DropReason) {}};
+};
+
+TEST_F(NotificationQueueTest, DeliversInOrder) {
+    sp<Listener> listener = new Listener();
+    enqueue(listener, "one", 1);
+    enqueue(listener, "two", 1);
+    enqueue(listener, "three", 1);
+    mQueue.flush();
+
+    EXPECT_EQ((std::vector<std::string>{"one", "two", "three"}), listener->waitFor(3));
+}
+
+TEST_F(NotificationQueueTest, DropsDuplicatesOfQueuedNotifications) {
+    sp<Listener> listener = new Listener();
+    enqueue(listener, "one", 1);
+    enqueue(listener, "one", 1); // e.x. through both an instance and a package subscription
+    enqueue(listener, "one", 2); // a new registration of the same instance
+    enqueue(listener, "end", 1);
+    mQueue.flush();
+
+    EXPECT_EQ((std::vector<std::string>{"one", "one", "end"}), listener->waitFor(3));
+}
+
+TEST_F(NotificationQueueTest, KeepsListenersApart) {
+    sp<Listener> first = new Listener();
+    sp<Listener> second = new Listener();
+    enqueue(first, "one", 1);
+    enqueue(second, "one", 1);
+    mQueue.flush();
+
+    EXPECT_EQ(1u, first->waitFor(1).size());
+    EXPECT_EQ(1u, second->waitFor(1).size());
+}
+
+TEST_F(NotificationQueueTest, DeliversATurnInOneCallToBatchListeners) {
+    sp<BatchListener> listener = new BatchListener();
+    for (size_t i = 0; i < NotificationQueue::kMaxBatch; i++) {
+        enqueue(listener, std::to_string(i).c_str(), 1);
+    }
+    mQueue.flush();
+
+    EXPECT_EQ(NotificationQueue::kMaxBatch, listener->waitFor(NotificationQueue::kMaxBatch).size());
+    EXPECT_EQ(1u, listener->calls());
+}
+
+}  // namespace
@@ -0,0 +1,105 @@
+/*
+ * RegistrationIndex: lookups by service and by pid, and removal.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "FakeService.h"
+#include "RegistrationIndex.h"
+
+using android::FakeService;
+using android::sp;
+using android::hidl::manager::implementation::HidlService;
+using android::hidl::manager::implementation::NamePool;
+using android::hidl::manager::implementation::RegistrationIndex;
+
+namespace {
+
+class RegistrationIndexTest : public ::testing::Test {
+protected:
+    // An entry for fqName/default, backed by service in pid.
+    HidlService* entry(const std::string& fqName, const sp<FakeService>& service, pid_t pid) {
+        mEntries.emplace_back(new HidlService(mNames.intern(fqName), mNames.intern("default"),
+                                              service, pid));
+        return mEntries.back().get();
+    }
+
+    static bool same(std::vector<HidlService*> actual, std::vector<HidlService*> expected) {
+        std::sort(actual.begin(), actual.end());
+        std::sort(expected.begin(), expected.end());
+        return actual == expected;
+    }
+
+    NamePool mNames;
+    std::vector<std::unique_ptr<HidlService>> mEntries;
+    RegistrationIndex mIndex;
+};
+
+TEST_F(RegistrationIndexTest, FindsEveryEntryOfAService) {
+    sp<FakeService> a = new FakeService({"a@1.0::IA"});
+    sp<FakeService> b = new FakeService({"b@1.0::IB"});
+    HidlService* a1 = entry("a@1.0::IA", a, 10);
+    HidlService* a2 = entry("android.hidl.base@1.0::IBase", a, 10);
+    HidlService* b1 = entry("b@1.0::IB", b, 20);
+    mIndex.add(a1);
+    mIndex.add(a2);
+    mIndex.add(b1);
+
+    EXPECT_TRUE(same(mIndex.findByService(a), {a1, a2}));
+    EXPECT_TRUE(same(mIndex.findByService(b), {b1}));
+    EXPECT_TRUE(same(mIndex.findByPid(10), {a1, a2}));
+    EXPECT_TRUE(same(mIndex.findByPid(20), {b1}));
+
+    EXPECT_TRUE(mIndex.findByService(new FakeService({"a@1.0::IA"})).empty());
+    EXPECT_TRUE(mIndex.findByService(nullptr).empty());
+    EXPECT_TRUE(mIndex.findByPid(30).empty());
+}
+
+TEST_F(RegistrationIndexTest, SkipsEntriesWithoutAService) {
+    HidlService* placeholder = entry("a@1.0::IA", nullptr, 10);
+    mIndex.add(placeholder);
+
+    EXPECT_TRUE(mIndex.findByPid(10).empty());
+}
+
+TEST_F(RegistrationIndexTest, RemoveForgetsOnlyThatEntry) {
+    sp<FakeService> a = new FakeService({"a@1.0::IA"});
+    HidlService* a1 = entry("a@1.0::IA", a, 10);
+    HidlService* a2 = entry("android.hidl.base@1.0::IBase", a, 10);
+    mIndex.add(a1);
+    mIndex.add(a2);
+
+    mIndex.remove(a1);
+    EXPECT_TRUE(same(mIndex.findByService(a), {a2}));
+    EXPECT_TRUE(same(mIndex.findByPid(10), {a2}));
+
+    mIndex.remove(a2);
+    EXPECT_TRUE(mIndex.findByService(a).empty());
+    EXPECT_TRUE(mIndex.findByPid(10).empty());
+
+    // Removing again is harmless.
+    mIndex.remove(a2);
+    EXPECT_TRUE(mIndex.findByService(a).empty());
+}
+
+// ServiceManager re-indexes an entry around setService().
+TEST_F(RegistrationIndexTest, ReindexesAReplacedService) {
+    sp<FakeService> before = new FakeService({"a@1.0::IA"});
+    sp<FakeService> after = new FakeService({"a@1.0::IA"});
+    HidlService* a = entry("a@1.0::IA", before, 10);
+    mIndex.add(a);
+
+    mIndex.remove(a);
+    a->setService(after, 20);
+    mIndex.add(a);
+
+    EXPECT_TRUE(mIndex.findByService(before).empty());
+    EXPECT_TRUE(mIndex.findByPid(10).empty());
+    EXPECT_TRUE(same(mIndex.findByService(after), {a}));
+    EXPECT_TRUE(same(mIndex.findByPid(20), {a}));
+}
+
+}  // namespace
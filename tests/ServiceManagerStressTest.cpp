@@ -0,0 +1,295 @@
+/*
+ * Hammers an in-process ServiceManager with concurrent reads, adds,
+ * deaths and listener changes. Meant to be run under TSan as well:
+ *   SANITIZE_HOST=thread atest hwservicemanager_test --host
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "FakeAccessControl.h"
+#include "FakeService.h"
+#include "ServiceManager.h"
+
+using android::FakeAccessControl;
+using android::FakeService;
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::hidl_vec;
+using android::hardware::Return;
+using android::hardware::Void;
+using android::hidl::base::V1_0::IBase;
+using android::hidl::manager::V1_0::IServiceNotification;
+using android::hidl::manager::implementation::ServiceManager;
+
+namespace {
+
+constexpr size_t kStableServices = 16;
+constexpr size_t kChurningServices = 16;
+constexpr size_t kWriters = 4;
+constexpr size_t kReaders = 4;
+constexpr size_t kRounds = 200;
+
+const char* kBaseInterface = "android.hidl.base@1.0::IBase";
+
+std::string stableName(size_t index) {
+    return "vendor.stress.stable" + std::to_string(index) + "@1.0::IStable";
+}
+
+std::string churningName(size_t index) {
+    return "vendor.stress.churn" + std::to_string(index) + "@1.0::IChurn";
+}
+
+// The first interface in service's chain, or "" if it has none.
+std::string interfaceOf(const sp<IBase>& service) {
+    std::string name;
+    service->interfaceChain([&](const hidl_vec<hidl_string>& chain) {
+        if (chain.size() > 0) {
+            name = chain[0];
+        }
+    });
+    return name;
+}
+
+class Listener : public IServiceNotification {
+public:
+    struct Notification {
+        std::string fqName;
+        std::string name;
+        bool preexisting;
+    };
+
+    Return<void> onRegistration(const hidl_string& fqName, const hidl_string& name,
+                                bool preexisting) override {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mNotifications.push_back({fqName, name, preexisting});
+        }
+        mChanged.notify_all();
+        return Void();
+    }
+
+    // Waits until count notifications arrived (or 10s passed), returns them all.
+    std::vector<Notification> waitFor(size_t count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mChanged.wait_for(lock, std::chrono::seconds(10),
+                          [&] { return mNotifications.size() >= count; });
+        return mNotifications;
+    }
+
+    std::vector<Notification> notifications() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mNotifications;
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    std::vector<Notification> mNotifications;
+};
+
+class ServiceManagerStressTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mManager = new ServiceManager(std::make_unique<FakeAccessControl>(),
+                                      kReaders /* maxWaiters */);
+        for (size_t i = 0; i < kStableServices; i++) {
+            mStable.push_back(new FakeService({stableName(i), kBaseInterface}));
+            ASSERT_TRUE(mManager->add("default", mStable.back()));
+        }
+    }
+
+    sp<ServiceManager> mManager;
+    std::vector<sp<FakeService>> mStable;
+};
+
+// Reads must always see every stable service as the object registered for
+// it, and a churning service either missing or as an object registered
+// under its name.
+TEST_F(ServiceManagerStressTest, ReadsRaceAddsAndDeaths) {
+    std::atomic<bool> done{false};
+    std::atomic<size_t> failures{0};
+
+    // churning[writer][i] is only added and killed by that writer.
+    std::vector<std::vector<sp<FakeService>>> churning(kWriters);
+
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < kWriters; w++) {
+        writers.emplace_back([&, w] {
+            for (size_t round = 0; round < kRounds; round++) {
+                std::vector<sp<FakeService>> services;
+                for (size_t i = w; i < kChurningServices; i += kWriters) {
+                    services.push_back(new FakeService({churningName(i), kBaseInterface}));
+                    if (!mManager->add("default", services.back())) {
+                        failures++;
+                    }
+                }
+                for (const sp<FakeService>& service : services) {
+                    service->die();
+                }
+                churning[w] = std::move(services);
+            }
+        });
+    }
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < kReaders; r++) {
+        readers.emplace_back([&, r] {
+            while (!done) {
+                for (size_t i = 0; i < kStableServices; i++) {
+                    sp<IBase> service = mManager->get(stableName(i), "default");
+                    if (service.get() != static_cast<IBase*>(mStable[i].get())) {
+                        failures++;
+                    }
+                }
+
+                const std::string churnName = churningName(r % kChurningServices);
+                sp<IBase> churn = mManager->get(churnName, "default");
+                if (churn != nullptr && interfaceOf(churn) != churnName) {
+                    failures++;
+                }
+
+                // Every stable entry, and at most maxOthers more.
+                auto checkEntries = [&](const hidl_vec<hidl_string>& entries, size_t maxOthers) {
+                    size_t stable = 0;
+                    for (const hidl_string& entry : entries) {
+                        stable += std::string(entry).find(".stable") != std::string::npos;
+                    }
+                    if (stable != kStableServices ||
+                            entries.size() > kStableServices + maxOthers) {
+                        failures++;
+                    }
+                };
+
+                mManager->list([&](const hidl_vec<hidl_string>& entries) {
+                    // One per churning service, plus android.hidl.base@1.0::IBase.
+                    checkEntries(entries, kChurningServices + 1);
+                });
+
+                mManager->listByInterface(stableName(r % kStableServices),
+                                          [&](const hidl_vec<hidl_string>& instances) {
+                    if (instances.size() != 1) {
+                        failures++;
+                    }
+                });
+
+                hidl_vec<hidl_string> fqNames = {stableName(0), churningName(0)};
+                hidl_vec<hidl_string> names = {"default", "default"};
+                mManager->getServices(fqNames, names, [&](const auto& services, const auto&) {
+                    if (services.size() != 2 ||
+                            services[0].get() != static_cast<IBase*>(mStable[0].get()) ||
+                            (services[1] != nullptr &&
+                             interfaceOf(services[1]) != churningName(0))) {
+                        failures++;
+                    }
+                });
+
+                mManager->listPage("vendor.stress.", "", 0,
+                                   [&](const hidl_vec<hidl_string>& entries, const hidl_string&) {
+                    checkEntries(entries, kChurningServices);
+                });
+
+                mManager->listPage(stableName(r % kStableServices) + "/", "", 0,
+                                   [&](const hidl_vec<hidl_string>& entries, const hidl_string&) {
+                    if (entries.size() != 1) {
+                        failures++;
+                    }
+                });
+
+                mManager->getChangesSince(0, [](uint64_t, bool, const auto&) {});
+            }
+        });
+    }
+
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(0u, failures.load());
+
+    // Every churning service died, so only the stable ones are left.
+    mManager->list([&](const hidl_vec<hidl_string>& entries) {
+        EXPECT_EQ(kStableServices, entries.size());
+    });
+}
+
+// Listeners come and go while the services they watch are added and die.
+// A listener that stays subscribed gets exactly one notification per add.
+TEST_F(ServiceManagerStressTest, ListenersRaceAddsAndDeaths) {
+    std::atomic<bool> done{false};
+
+    sp<Listener> steady = new Listener();
+    ASSERT_TRUE(mManager->registerForNotifications(churningName(0), "default", steady));
+
+    std::thread writer([&] {
+        for (size_t round = 0; round < kRounds; round++) {
+            sp<FakeService> service = new FakeService({churningName(0), kBaseInterface});
+            mManager->add("default", service);
+            service->die();
+        }
+        done = true;
+    });
+
+    std::vector<sp<Listener>> listeners;
+    for (size_t i = 0; i < kReaders; i++) {
+        listeners.push_back(new Listener());
+    }
+
+    std::vector<std::thread> subscribers;
+    for (const sp<Listener>& listener : listeners) {
+        subscribers.emplace_back([&, listener] {
+            while (!done) {
+                mManager->registerForNotifications(churningName(0), "default", listener);
+                mManager->registerForNotifications(churningName(0), "", listener);
+                mManager->unregisterForNotifications(churningName(0), "", listener);
+                mManager->unregisterForNotifications("", "", listener);
+            }
+        });
+    }
+
+    // Parks in waitForService() while the writer keeps adding the service.
+    std::thread waiter([&] {
+        while (!done) {
+            mManager->waitForService(churningName(0), "default", 1'000'000 /* 1ms */);
+        }
+    });
+
+    writer.join();
+    for (std::thread& subscriber : subscribers) {
+        subscriber.join();
+    }
+    waiter.join();
+
+    std::vector<Listener::Notification> received = steady->waitFor(kRounds);
+    EXPECT_EQ(kRounds, received.size());
+    for (const Listener::Notification& notification : received) {
+        EXPECT_EQ(churningName(0), notification.fqName);
+        EXPECT_EQ("default", notification.name);
+        EXPECT_FALSE(notification.preexisting);
+    }
+
+    // Whatever reached the others was about the instance they subscribed to.
+    for (const sp<Listener>& listener : listeners) {
+        for (const Listener::Notification& notification : listener->notifications()) {
+            EXPECT_EQ(churningName(0), notification.fqName);
+            EXPECT_EQ("default", notification.name);
+        }
+    }
+
+    mManager->list([&](const hidl_vec<hidl_string>& entries) {
+        EXPECT_EQ(kStableServices, entries.size());
+    });
+}
+
+}  // namespace
@@ -0,0 +1,152 @@
+/*
+ * TokenManager's slot map: slot reuse, generations, LRU eviction and
+ * per-creator quotas.
+ */
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "FakeService.h"
+#include "TokenManager.h"
+
+using android::FakeService;
+
+namespace android {
+namespace hidl {
+namespace token {
+namespace V1_0 {
+namespace implementation {
+
+class TokenManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override { mManager = new TokenManager(); }
+
+    static hidl_vec<uint8_t> create(const sp<TokenManager>& manager, const sp<IBase>& store) {
+        hidl_vec<uint8_t> token;
+        manager->createToken(store, [&](const hidl_vec<uint8_t>& created) { token = created; });
+        return token;
+    }
+
+    hidl_vec<uint8_t> create(const sp<IBase>& store) { return create(mManager, store); }
+
+    // What token is for, or nullptr.
+    sp<IBase> get(const hidl_vec<uint8_t>& token) { return mManager->get(token); }
+
+    static uint32_t indexOf(const hidl_vec<uint8_t>& token) {
+        return static_cast<uint32_t>(TokenManager::getTokenId(token));
+    }
+
+    static uint32_t generationOf(const hidl_vec<uint8_t>& token) {
+        return static_cast<uint32_t>(TokenManager::getTokenId(token) >> 32);
+    }
+
+    // Sets the generation the next token in the free slot index gets.
+    void setGeneration(uint32_t index, uint32_t generation) {
+        std::lock_guard<std::mutex> lock(mManager->mLock);
+        ASSERT_TRUE(mManager->mSlots[index].interface == nullptr);
+        mManager->mSlots[index].generation = generation;
+    }
+
+    sp<FakeService> service() { return new FakeService({"a@1.0::IA"}); }
+
+    sp<TokenManager> mManager;
+};
+
+TEST_F(TokenManagerTest, ReusesAFreedSlotWithTheNextGeneration) {
+    sp<FakeService> first = service();
+    hidl_vec<uint8_t> firstToken = create(first);
+    ASSERT_TRUE(mManager->unregister(firstToken));
+
+    sp<FakeService> second = service();
+    hidl_vec<uint8_t> secondToken = create(second);
+
+    EXPECT_EQ(indexOf(firstToken), indexOf(secondToken));
+    EXPECT_EQ(generationOf(firstToken) + 1, generationOf(secondToken));
+    EXPECT_EQ(1u, mManager->liveTokens());
+}
+
+TEST_F(TokenManagerTest, RejectsStaleTokensOfAReusedSlot) {
+    hidl_vec<uint8_t> stale = create(service());
+    ASSERT_TRUE(mManager->unregister(stale));
+
+    sp<FakeService> current = service();
+    hidl_vec<uint8_t> token = create(current);
+    ASSERT_EQ(indexOf(stale), indexOf(token));
+
+    EXPECT_TRUE(get(stale) == nullptr);
+    EXPECT_FALSE(mManager->unregister(stale));
+    EXPECT_EQ(static_cast<IBase*>(current.get()), get(token).get());
+}
+
+TEST_F(TokenManagerTest, RetiresASlotWhoseGenerationWouldWrap) {
+    hidl_vec<uint8_t> token = create(service());
+    ASSERT_TRUE(mManager->unregister(token));
+    setGeneration(indexOf(token), UINT32_MAX);
+
+    hidl_vec<uint8_t> last = create(service());
+    ASSERT_EQ(indexOf(token), indexOf(last));
+    EXPECT_EQ(UINT32_MAX, generationOf(last));
+    ASSERT_TRUE(mManager->unregister(last));
+
+    hidl_vec<uint8_t> next = create(service());
+    EXPECT_NE(indexOf(last), indexOf(next));
+    EXPECT_EQ(1u, generationOf(next));
+    EXPECT_TRUE(get(last) == nullptr);
+}
+
+TEST_F(TokenManagerTest, EvictsTheLeastRecentlyUsedToken) {
+    mManager = new TokenManager(nullptr, {3 /* maxTokens */, 0});
+    std::vector<sp<FakeService>> services;
+    std::vector<hidl_vec<uint8_t>> tokens;
+    for (size_t i = 0; i < 4; i++) {
+        services.push_back(service());
+    }
+    for (size_t i = 0; i < 3; i++) {
+        tokens.push_back(create(services[i]));
+    }
+
+    // Fetching tokens[0] makes tokens[1] the least recently used.
+    ASSERT_TRUE(get(tokens[0]) != nullptr);
+    tokens.push_back(create(services[3]));
+    EXPECT_EQ(3u, mManager->liveTokens());
+    EXPECT_TRUE(get(tokens[1]) == nullptr);
+
+    // Then tokens[2], created before the others still live.
+    tokens.push_back(create(services[1]));
+    EXPECT_TRUE(get(tokens[2]) == nullptr);
+    EXPECT_TRUE(get(tokens[0]) != nullptr);
+    EXPECT_TRUE(get(tokens[3]) != nullptr);
+    EXPECT_TRUE(get(tokens[4]) != nullptr);
+}
+
+TEST_F(TokenManagerTest, CountsTokensAgainstTheirCreator) {
+    pid_t caller = 10;
+    mManager = new TokenManager([&] { return caller; }, {0, 2 /* maxTokensPerCreator */});
+    sp<FakeService> store = service();
+
+    hidl_vec<uint8_t> first = create(store);
+    hidl_vec<uint8_t> second = create(store);
+    EXPECT_EQ(0u, create(store).size());
+
+    caller = 20;
+    hidl_vec<uint8_t> other = create(store);
+    EXPECT_NE(0u, other.size());
+
+    // Unregistering or the store dying gives the creator its quota back.
+    caller = 10;
+    ASSERT_TRUE(mManager->unregister(first));
+    EXPECT_NE(0u, create(store).size());
+    EXPECT_EQ(0u, create(store).size());
+
+    store->die();
+    EXPECT_EQ(0u, mManager->liveTokens());
+    EXPECT_NE(0u, create(service()).size());
+    EXPECT_NE(0u, create(service()).size());
+}
+
+}  // namespace implementation
+}  // namespace V1_0
+}  // namespace token
+}  // namespace hidl
+}  // namespace android
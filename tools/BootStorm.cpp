@@ -0,0 +1,321 @@
+/*
+ * Replays a synthetic boot against an in-process ServiceManager: N HALs
+ * add() themselves while M framework clients look services up and K
+ * listeners wait for registrations. Each simulated process is a thread
+ * that calls the manager directly, with a fake access control backend.
+ *
+ *   hwservicemanager_boot_storm --registrants 300 --clients 100 --listeners 50 \
+ *       --chain 2-6 --arrival poisson --window-ms 2000
+ *
+ * Prints client-side latency percentiles per method and how long it took
+ * until every registrant was added, every client was done and every
+ * listener was notified.
+ */
+
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "FakeAccessControl.h"
+#include "FakeService.h"
+#include "MethodStats.h"
+#include "ServiceManager.h"
+
+using android::FakeAccessControl;
+using android::FakeService;
+using android::MethodStats;
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::Return;
+using android::hardware::Void;
+using android::hidl::manager::V1_0::IServiceNotification;
+using android::hidl::manager::implementation::ServiceManager;
+using std::chrono::steady_clock;
+
+namespace {
+
+enum Method : size_t {
+    kAdd,
+    kGetTransport,
+    kGet,
+    kWaitForService,
+    kRegisterForNotifications,
+};
+
+enum Counter : size_t {
+    kGetMiss,
+    kWaitTimedOut,
+    kListenerTimedOut,
+};
+
+enum class Arrival { BURST, UNIFORM, POISSON };
+
+struct Options {
+    size_t registrants = 200;
+    size_t clients = 50;
+    size_t listeners = 20;
+    size_t minChain = 2;
+    size_t maxChain = 4;
+    size_t lookupsPerClient = 10;
+    Arrival arrival = Arrival::UNIFORM;
+    std::chrono::milliseconds window{1000};
+    uint32_t seed = 1;
+};
+
+std::string interfaceName(size_t registrant, size_t minor = 0) {
+    return "vendor.storm.hal" + std::to_string(registrant) + "@1." + std::to_string(minor) +
+           "::IStorm";
+}
+
+/**
+ * Start offsets from the beginning of the run for count processes of one
+ * kind, following the arrival distribution.
+ */
+std::vector<steady_clock::duration> arrivals(const Options& options, size_t count,
+                                             std::mt19937* rng) {
+    std::vector<steady_clock::duration> offsets(count, steady_clock::duration::zero());
+    if (count == 0 || options.arrival == Arrival::BURST) {
+        return offsets;
+    }
+
+    const double window = std::chrono::duration<double>(options.window).count();
+    if (options.arrival == Arrival::UNIFORM) {
+        std::uniform_real_distribution<double> uniform(0, window);
+        for (auto& offset : offsets) {
+            offset = std::chrono::duration_cast<steady_clock::duration>(
+                    std::chrono::duration<double>(uniform(*rng)));
+        }
+    } else {
+        // Poisson process whose expected last arrival is at the end of the window.
+        std::exponential_distribution<double> gap(count / window);
+        double at = 0;
+        for (auto& offset : offsets) {
+            at += gap(*rng);
+            offset = std::chrono::duration_cast<steady_clock::duration>(
+                    std::chrono::duration<double>(at));
+        }
+    }
+    return offsets;
+}
+
+class Listener : public IServiceNotification {
+public:
+    Return<void> onRegistration(const hidl_string&, const hidl_string&, bool) override {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mNotified = true;
+        }
+        mCondition.notify_all();
+        return Void();
+    }
+
+    bool waitUntil(steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mLock);
+        return mCondition.wait_until(lock, deadline, [this] { return mNotified; });
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    bool mNotified = false;
+};
+
+bool parseRange(const std::string& arg, size_t* min, size_t* max) {
+    std::vector<std::string> bounds = android::base::Split(arg, "-");
+    if (bounds.size() == 1) {
+        bounds.push_back(bounds[0]);
+    }
+    return bounds.size() == 2 &&
+           android::base::ParseUint(bounds[0], min) &&
+           android::base::ParseUint(bounds[1], max) &&
+           *min >= 1 && *min <= *max;
+}
+
+void usage(const char* name) {
+    std::cerr
+        << "usage: " << name << " [options]\n"
+        << "    --registrants N   HAL processes calling add() (default 200)\n"
+        << "    --clients M       processes calling getTransport()/get() (default 50)\n"
+        << "    --listeners K     processes calling registerForNotifications() (default 20)\n"
+        << "    --chain MIN-MAX   interface chain length of each HAL, incl. IBase (default 2-4)\n"
+        << "    --lookups L       lookups per client (default 10)\n"
+        << "    --arrival burst|uniform|poisson   when processes start (default uniform)\n"
+        << "    --window-ms W     arrivals are spread over W ms (default 1000)\n"
+        << "    --seed S          random seed (default 1)\n";
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+    static const option kOptions[] = {
+        {"registrants", required_argument, nullptr, 'n'},
+        {"clients", required_argument, nullptr, 'm'},
+        {"listeners", required_argument, nullptr, 'k'},
+        {"chain", required_argument, nullptr, 'c'},
+        {"lookups", required_argument, nullptr, 'l'},
+        {"arrival", required_argument, nullptr, 'a'},
+        {"window-ms", required_argument, nullptr, 'w'},
+        {"seed", required_argument, nullptr, 's'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+        bool ok = true;
+        uint64_t value = 0;
+        switch (c) {
+            case 'n': ok = android::base::ParseUint(optarg, &options->registrants); break;
+            case 'm': ok = android::base::ParseUint(optarg, &options->clients); break;
+            case 'k': ok = android::base::ParseUint(optarg, &options->listeners); break;
+            case 'l': ok = android::base::ParseUint(optarg, &options->lookupsPerClient); break;
+            case 'c': ok = parseRange(optarg, &options->minChain, &options->maxChain); break;
+            case 'w':
+                ok = android::base::ParseUint(optarg, &value);
+                options->window = std::chrono::milliseconds(value);
+                break;
+            case 's':
+                ok = android::base::ParseUint(optarg, &options->seed);
+                break;
+            case 'a':
+                if (std::string(optarg) == "burst") {
+                    options->arrival = Arrival::BURST;
+                } else if (std::string(optarg) == "uniform") {
+                    options->arrival = Arrival::UNIFORM;
+                } else if (std::string(optarg) == "poisson") {
+                    options->arrival = Arrival::POISSON;
+                } else {
+                    ok = false;
+                }
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return optind == argc && (options->registrants > 0 ||
+                              (options->clients == 0 && options->listeners == 0));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Every client may be parked in waitForService() at the same time.
+    sp<ServiceManager> manager = new ServiceManager(std::make_unique<FakeAccessControl>(),
+                                                    options.clients);
+    MethodStats stats({"add", "getTransport", "get", "waitForService", "registerForNotifications"},
+                      {"get_miss", "wait_timed_out", "listener_timed_out"});
+
+    std::mt19937 rng(options.seed);
+    std::uniform_int_distribution<size_t> chainLength(options.minChain, options.maxChain);
+    std::uniform_int_distribution<size_t> anyRegistrant(0, options.registrants - 1);
+
+    auto registrantArrivals = arrivals(options, options.registrants, &rng);
+    auto clientArrivals = arrivals(options, options.clients, &rng);
+    auto listenerArrivals = arrivals(options, options.listeners, &rng);
+
+    std::vector<std::thread> threads;
+    const hidl_string instance = "default";
+    const steady_clock::time_point start = steady_clock::now() + std::chrono::milliseconds(50);
+
+    for (size_t i = 0; i < options.registrants; i++) {
+        std::vector<std::string> chain;
+        for (size_t minor = chainLength(rng) - 1; minor > 0; minor--) {
+            chain.push_back(interfaceName(i, minor - 1));
+        }
+        chain.push_back("android.hidl.base@1.0::IBase");
+
+        sp<FakeService> service = new FakeService(std::move(chain));
+        threads.emplace_back([&, service, at = start + registrantArrivals[i]] {
+            std::this_thread::sleep_until(at);
+            auto timer = stats.time(kAdd);
+            manager->add(instance, service);
+        });
+    }
+
+    for (size_t i = 0; i < options.clients; i++) {
+        std::vector<hidl_string> targets;
+        for (size_t j = 0; j < options.lookupsPerClient; j++) {
+            targets.push_back(interfaceName(anyRegistrant(rng)));
+        }
+
+        threads.emplace_back([&, targets, at = start + clientArrivals[i]] {
+            std::this_thread::sleep_until(at);
+            for (const hidl_string& fqName : targets) {
+                {
+                    auto timer = stats.time(kGetTransport);
+                    manager->getTransport(fqName, instance);
+                }
+
+                sp<android::hidl::base::V1_0::IBase> service;
+                {
+                    auto timer = stats.time(kGet);
+                    service = manager->get(fqName, instance);
+                }
+                if (service != nullptr) {
+                    continue;
+                }
+
+                stats.increment(kGetMiss);
+                auto timer = stats.time(kWaitForService);
+                service = manager->waitForService(fqName, instance,
+                                                  ServiceManager::kMaxWaitForServiceNanos);
+                if (service == nullptr) {
+                    stats.increment(kWaitTimedOut);
+                }
+            }
+        });
+    }
+
+    std::vector<sp<Listener>> listeners;
+    for (size_t i = 0; i < options.listeners; i++) {
+        listeners.push_back(new Listener());
+        hidl_string target = interfaceName(anyRegistrant(rng));
+
+        threads.emplace_back([&, listener = listeners.back(), target,
+                              at = start + listenerArrivals[i]] {
+            std::this_thread::sleep_until(at);
+            auto timer = stats.time(kRegisterForNotifications);
+            manager->registerForNotifications(target, instance, listener);
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    const steady_clock::time_point listenerDeadline = steady_clock::now() + std::chrono::seconds(10);
+    for (const sp<Listener>& listener : listeners) {
+        if (!listener->waitUntil(listenerDeadline)) {
+            stats.increment(kListenerTimedOut);
+        }
+    }
+
+    const steady_clock::duration quiesce = steady_clock::now() - start;
+
+    std::cout << "registrants=" << options.registrants
+              << " clients=" << options.clients
+              << " listeners=" << options.listeners
+              << " chain=" << options.minChain << "-" << options.maxChain
+              << " window_ms=" << options.window.count() << "\n\n"
+              << stats.dump() << "\n"
+              << "time_to_quiesce_ms: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(quiesce).count() << "\n";
+    return 0;
+}
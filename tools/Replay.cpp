@@ -0,0 +1,433 @@
+/*
+ * Replays a call trace recorded by hwservicemanager (see CallRecorder and
+ * the hwservicemanager.trace_file property) against an in-process
+ * ServiceManager and TokenManager, so a device's real boot or app-launch
+ * traffic can be rerun on a host before and after a change.
+ *
+ *   hwservicemanager_replay [--timed] [--max-tokens=N] [--max-tokens-per-pid=N] trace
+ *
+ * Calls are replayed one at a time in the order they returned on the
+ * device. Services, listeners and tokens are stand-ins created from the
+ * trace, and every call is allowed or denied as it was when recorded.
+ * With --timed, a call isn't started before its recorded start offset.
+ * Pass the device's token limits (ro.hwservicemanager.max_tokens*), so
+ * tokens get the same ids as when recorded.
+ *
+ * Prints the recorded and the replayed latency of every method, and the
+ * calls whose result differs from the recorded one.
+ */
+
+#include <getopt.h>
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "AccessControlBackend.h"
+#include "CallRecorder.h"
+#include "FakeService.h"
+#include "MethodStats.h"
+#include "ServiceManager.h"
+#include "TokenManager.h"
+
+using android::AccessControlBackend;
+using android::FakeBinder;
+using android::FakeService;
+using android::MethodStats;
+using android::sp;
+using android::hardware::hidl_string;
+using android::hardware::hidl_vec;
+using android::hardware::Return;
+using android::hardware::Void;
+using android::hidl::base::V1_0::IBase;
+using android::hidl::manager::V1_0::IServiceNotification;
+using android::hidl::manager::implementation::CallRecorder;
+using android::hidl::manager::implementation::CallTraceReader;
+using android::hidl::manager::implementation::RegistryChange;
+using android::hidl::manager::implementation::ServiceManager;
+using android::hidl::token::V1_0::implementation::TokenManager;
+using std::chrono::steady_clock;
+
+namespace {
+
+using Method = CallRecorder::Method;
+
+// Names for MethodStats, indexed by Method - 1.
+const std::vector<const char*> kMethodNames = {
+    "get", "add", "getTransport", "list", "listByInterface", "registerForNotifications",
+    "unregisterForNotifications", "registerPassthroughClient", "debugDump", "getServices",
+    "waitForService", "listPage", "getGeneration", "getChangesSince", "serviceDied",
+    "createToken", "getToken", "unregisterToken",
+};
+
+enum Counter : size_t {
+    kMismatch,
+    kUnknownMethod,
+};
+
+// Prints at most this many of the mismatching calls.
+constexpr size_t kMaxMismatchesShown = 20;
+
+/**
+ * Allows or denies each call as the recorded one was, for the recorded
+ * caller. A denied getServices() call denies every name in it.
+ */
+class ReplayAccessControl : public AccessControlBackend {
+public:
+    void setCall(const CallTraceReader::Call& call) {
+        mCaller = {!call.sid.empty(), call.sid, call.pid};
+        mAllow = (call.flags & CallRecorder::kFlagDenied) == 0;
+    }
+
+    CallingContext getCallingContext() override { return mCaller; }
+
+    bool canAdd(std::string_view, const CallingContext&) override { return mAllow; }
+    bool canGet(std::string_view, const CallingContext&) override { return mAllow; }
+    bool canList(const CallingContext&) override { return mAllow; }
+
+private:
+    CallingContext mCaller{false, "", 0};
+    bool mAllow = true;
+};
+
+class Listener : public FakeBinder<IServiceNotification> {
+public:
+    Return<void> onRegistration(const hidl_string&, const hidl_string&, bool) override {
+        return Void();
+    }
+};
+
+/**
+ * Stand-ins for the binders, listeners and tokens of the trace, keyed by
+ * the ids the trace gave them.
+ */
+class Replayer {
+public:
+    Replayer(ReplayAccessControl* acl, TokenManager::Limits tokenLimits)
+        : mAcl(acl),
+          mManager(new ServiceManager(std::unique_ptr<AccessControlBackend>(acl))),
+          mTokens(new TokenManager([acl] { return acl->getCallingContext().pid; },
+                                   tokenLimits)),
+          mRecorded(kMethodNames, {}),
+          mReplayed(kMethodNames, {"result_mismatch", "unknown_method"}),
+          mFirstGeneration(mManager->getGeneration()) {}
+
+    void replay(const CallTraceReader::Call& call);
+
+    const MethodStats& recorded() const { return mRecorded; }
+    const MethodStats& replayed() const { return mReplayed; }
+
+private:
+    struct Outcome {
+        uint8_t result = 0;
+        uint64_t arg = 0;
+    };
+
+    // Returns false if the method isn't known.
+    bool dispatch(const CallTraceReader::Call& call, Outcome* outcome);
+
+    sp<FakeService> serviceFor(uint64_t binder, const std::vector<std::string>& chain);
+    sp<Listener> listenerFor(uint64_t binder);
+    hidl_vec<uint8_t> tokenFor(uint64_t recordedId) const;
+
+    void reportMismatch(const CallTraceReader::Call& call, const Outcome& outcome);
+
+    ReplayAccessControl* mAcl; // owned by mManager
+    sp<ServiceManager> mManager;
+    sp<TokenManager> mTokens;
+
+    std::map<uint64_t, sp<FakeService>> mServices;
+    std::map<uint64_t, sp<Listener>> mListeners;
+    std::map<uint64_t, hidl_vec<uint8_t>> mTokenValues; // recorded token id -> replayed token
+
+    MethodStats mRecorded;
+    MethodStats mReplayed;
+    // Recorded generations are relative to the first one of their manager.
+    const uint64_t mFirstGeneration;
+    size_t mCalls = 0;
+};
+
+void Replayer::replay(const CallTraceReader::Call& call) {
+    const size_t index = static_cast<size_t>(call.method) - 1;
+    mCalls++;
+
+    mAcl->setCall(call);
+
+    Outcome outcome;
+    const steady_clock::time_point start = steady_clock::now();
+    if (index >= kMethodNames.size() || !dispatch(call, &outcome)) {
+        mReplayed.increment(kUnknownMethod);
+        return;
+    }
+    mReplayed.record(index, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    steady_clock::now() - start).count());
+    mRecorded.record(index, call.durationNanos);
+
+    if (outcome.result != call.result || outcome.arg != call.arg) {
+        reportMismatch(call, outcome);
+    }
+}
+
+bool Replayer::dispatch(const CallTraceReader::Call& call, Outcome* outcome) {
+    const hidl_string fqName = call.fqName;
+    const hidl_string instance = call.instance;
+
+    // Calls whose arg is an input rather than a result echo it back.
+    switch (call.method) {
+        case Method::WAIT_FOR_SERVICE:
+        case Method::LIST_PAGE:
+        case Method::GET_CHANGES_SINCE:
+        case Method::SERVICE_DIED:
+        case Method::GET_TOKEN:
+        case Method::UNREGISTER_TOKEN:
+            outcome->arg = call.arg;
+            break;
+        default:
+            break;
+    }
+
+    switch (call.method) {
+        case Method::GET: {
+            sp<IBase> service = mManager->get(fqName, instance);
+            outcome->result = service != nullptr;
+            return true;
+        }
+        case Method::ADD: {
+            if (call.binder == 0) { // add() of nullptr
+                outcome->result = mManager->add(instance, nullptr);
+                return true;
+            }
+            std::vector<std::string> chain = android::base::Split(call.fqName, ",");
+            outcome->result = mManager->add(instance, serviceFor(call.binder, chain));
+            return true;
+        }
+        case Method::GET_TRANSPORT:
+            outcome->result = static_cast<uint8_t>(
+                    static_cast<ServiceManager::Transport>(mManager->getTransport(fqName, instance)));
+            return true;
+        case Method::LIST:
+            mManager->list([&](const hidl_vec<hidl_string>& list) { outcome->arg = list.size(); });
+            return true;
+        case Method::LIST_BY_INTERFACE:
+            mManager->listByInterface(fqName, [&](const hidl_vec<hidl_string>& list) {
+                outcome->arg = list.size();
+            });
+            return true;
+        case Method::REGISTER_FOR_NOTIFICATIONS:
+            outcome->result = mManager->registerForNotifications(
+                    fqName, instance, call.binder == 0 ? nullptr : listenerFor(call.binder));
+            return true;
+        case Method::UNREGISTER_FOR_NOTIFICATIONS:
+            outcome->result = mManager->unregisterForNotifications(
+                    fqName, instance, call.binder == 0 ? nullptr : listenerFor(call.binder));
+            return true;
+        case Method::REGISTER_PASSTHROUGH_CLIENT:
+            mManager->registerPassthroughClient(fqName, instance);
+            return true;
+        case Method::DEBUG_DUMP:
+            mManager->debugDump([](const auto&) {});
+            return true;
+        case Method::GET_SERVICES: {
+            std::vector<std::string> fqNames;
+            std::vector<std::string> names;
+            if (!call.fqName.empty() || !call.instance.empty()) {
+                fqNames = android::base::Split(call.fqName, ",");
+                names = android::base::Split(call.instance, ",");
+            }
+            hidl_vec<hidl_string> fqNameVec;
+            hidl_vec<hidl_string> nameVec;
+            fqNameVec.resize(fqNames.size());
+            nameVec.resize(names.size());
+            for (size_t i = 0; i < fqNames.size(); i++) fqNameVec[i] = fqNames[i];
+            for (size_t i = 0; i < names.size(); i++) nameVec[i] = names[i];
+
+            mManager->getServices(fqNameVec, nameVec,
+                                  [&](const hidl_vec<sp<IBase>>& services, const auto&) {
+                for (const sp<IBase>& service : services) {
+                    outcome->arg += service != nullptr;
+                }
+            });
+            return true;
+        }
+        case Method::WAIT_FOR_SERVICE: {
+            // Replayed on one thread, so nothing could be added while waiting.
+            sp<IBase> service = mManager->waitForService(fqName, instance, 0 /* timeoutNanos */);
+            outcome->result = service != nullptr;
+            return true;
+        }
+        case Method::LIST_PAGE:
+            mManager->listPage(fqName, instance, call.arg, [](const auto&, const auto&) {});
+            return true;
+        case Method::GET_GENERATION:
+            mManager->getGeneration();
+            return true;
+        case Method::GET_CHANGES_SINCE: {
+            // 0 stands for a generation older than the recorded journal;
+            // generation 0 is older than this one too.
+            const uint64_t generation = call.arg == 0 ? 0 : mFirstGeneration + call.arg - 1;
+            mManager->getChangesSince(generation, [&](uint64_t, bool resync,
+                                                      const hidl_vec<RegistryChange>&) {
+                outcome->result = !resync;
+            });
+            return true;
+        }
+        case Method::SERVICE_DIED: {
+            // The recorder forgets the id of a dead binder, so forget it here too.
+            if (auto it = mServices.find(call.binder); it != mServices.end()) {
+                sp<FakeService> service = it->second;
+                mServices.erase(it);
+                service->die();
+            } else if (auto it = mListeners.find(call.binder); it != mListeners.end()) {
+                sp<Listener> listener = it->second;
+                mListeners.erase(it);
+                listener->die();
+            }
+            return true;
+        }
+        case Method::CREATE_TOKEN: {
+            sp<IBase> store;
+            if (call.binder != 0) {
+                auto it = mServices.find(call.binder);
+                store = it != mServices.end()
+                        ? it->second
+                        : serviceFor(call.binder, {"android.hidl.base@1.0::IBase"});
+            }
+            mTokens->createToken(store, [&](const hidl_vec<uint8_t>& token) {
+                outcome->result = token.size() > 0;
+                // Token ids are allocated the same way on every run, so the
+                // replayed id must match the recorded one. The HMAC after
+                // it is keyed per run and can't be compared.
+                outcome->arg = TokenManager::getTokenId(token);
+                if (outcome->result) {
+                    mTokenValues[call.arg] = token;
+                }
+            });
+            return true;
+        }
+        case Method::GET_TOKEN: {
+            sp<IBase> interface = mTokens->get(tokenFor(call.arg));
+            outcome->result = interface != nullptr;
+            return true;
+        }
+        case Method::UNREGISTER_TOKEN:
+            outcome->result = mTokens->unregister(tokenFor(call.arg));
+            if (outcome->result) {
+                mTokenValues.erase(call.arg);
+            }
+            return true;
+    }
+    return false;
+}
+
+sp<FakeService> Replayer::serviceFor(uint64_t binder, const std::vector<std::string>& chain) {
+    sp<FakeService>& service = mServices[binder];
+    if (service == nullptr) {
+        service = new FakeService(chain);
+    }
+    return service;
+}
+
+sp<Listener> Replayer::listenerFor(uint64_t binder) {
+    sp<Listener>& listener = mListeners[binder];
+    if (listener == nullptr) {
+        listener = new Listener();
+    }
+    return listener;
+}
+
+hidl_vec<uint8_t> Replayer::tokenFor(uint64_t recordedId) const {
+    auto it = mTokenValues.find(recordedId);
+    if (it == mTokenValues.end()) {
+        return {}; // a token that was never created here; rejected as invalid
+    }
+    return it->second;
+}
+
+void Replayer::reportMismatch(const CallTraceReader::Call& call, const Outcome& outcome) {
+    mReplayed.increment(kMismatch);
+    if (mReplayed.counter(kMismatch) > kMaxMismatchesShown) {
+        return;
+    }
+
+    std::cerr << "call " << mCalls << ": " << kMethodNames[static_cast<size_t>(call.method) - 1]
+              << "(" << call.fqName << ", " << call.instance << ")"
+              << " recorded result=" << int(call.result) << " arg=" << call.arg
+              << ", replayed result=" << int(outcome.result) << " arg=" << outcome.arg << "\n";
+}
+
+void usage(const char* name) {
+    std::cerr << "usage: " << name
+              << " [--timed] [--max-tokens=N] [--max-tokens-per-pid=N] trace\n"
+              << "    --timed                 don't start a call before its recorded start offset\n"
+              << "    --max-tokens=N          TokenManager::Limits::maxTokens of the device\n"
+              << "    --max-tokens-per-pid=N  TokenManager::Limits::maxTokensPerCreator of the device\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    static const option kOptions[] = {
+        {"timed", no_argument, nullptr, 't'},
+        {"max-tokens", required_argument, nullptr, 'm'},
+        {"max-tokens-per-pid", required_argument, nullptr, 'p'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    bool timed = false;
+    TokenManager::Limits tokenLimits = {};
+    int c;
+    while ((c = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+        bool valid = true;
+        switch (c) {
+            case 't':
+                timed = true;
+                break;
+            case 'm':
+                valid = android::base::ParseUint(optarg, &tokenLimits.maxTokens);
+                break;
+            case 'p':
+                valid = android::base::ParseUint(optarg, &tokenLimits.maxTokensPerCreator);
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    CallTraceReader reader;
+    if (!reader.open(argv[optind])) {
+        std::cerr << "Can't read a call trace from " << argv[optind] << "\n";
+        return 1;
+    }
+
+    Replayer replayer(new ReplayAccessControl(), tokenLimits);
+
+    const steady_clock::time_point start = steady_clock::now();
+    CallTraceReader::Call call;
+    size_t calls = 0;
+    while (reader.next(&call)) {
+        if (timed) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(call.startMicros));
+        }
+        replayer.replay(call);
+        calls++;
+    }
+
+    std::cout << "calls: " << calls << "\n\nrecorded:\n" << replayer.recorded().dump()
+              << "\nreplayed:\n" << replayer.replayed().dump();
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Restarts an in-process ServiceManager while simulated HALs hold
+ * registrations in it, and checks that restart recovery brings every
+ * registration back without restarting the HALs.
+ *
+ *   hwservicemanager_restart_drill --hals 200 --instances 2 --restarts 5
+ *
+ * Each HAL registers its services through a RegistrationKeeper that
+ * watches the restart epoch in a fake property service. A restart drops
+ * the manager, as a crash would, starts a new one and publishes the next
+ * epoch, as hwservicemanager's main() does.
+ *
+ * Prints, for every restart, how long it took until every service could
+ * be looked up again and was the same object the HAL registered. Exits
+ * with 1 if some service didn't come back.
+ */
+
+#include <getopt.h>
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/parseint.h>
+
+#include "FakeAccessControl.h"
+#include "FakeProperties.h"
+#include "FakeService.h"
+#include "RestartRecovery.h"
+#include "ServiceManager.h"
+
+using android::FakeAccessControl;
+using android::FakeProperties;
+using android::FakeService;
+using android::sp;
+using android::hidl::base::V1_0::IBase;
+using android::hidl::manager::implementation::publishRestartEpoch;
+using android::hidl::manager::implementation::RegistrationKeeper;
+using android::hidl::manager::implementation::ServiceManager;
+using std::chrono::steady_clock;
+
+namespace {
+
+// How long to wait for the services to come back after a restart.
+constexpr std::chrono::seconds kRecoveryTimeout{10};
+// Keepers wake up this often, so the drill can tear them down quickly.
+constexpr std::chrono::milliseconds kWatchTimeout{100};
+
+struct Options {
+    size_t hals = 100;
+    size_t instances = 1;
+    size_t restarts = 3;
+};
+
+struct Hal {
+    std::unique_ptr<RegistrationKeeper> keeper;
+    std::string fqName;
+    sp<FakeService> service;
+};
+
+/**
+ * Stands in for the context object: the manager currently running, or
+ * nullptr between a crash and the restart.
+ */
+class ManagerSlot {
+public:
+    sp<ServiceManager> get() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mManager;
+    }
+
+    void set(const sp<ServiceManager>& manager) {
+        std::lock_guard<std::mutex> lock(mLock);
+        mManager = manager;
+    }
+
+private:
+    std::mutex mLock;
+    sp<ServiceManager> mManager;
+};
+
+std::string instanceName(size_t instance) {
+    return instance == 0 ? "default" : "instance" + std::to_string(instance);
+}
+
+// Number of (HAL, instance) pairs the manager doesn't return the HAL's own service for.
+size_t countMissing(const sp<ServiceManager>& manager, const std::vector<Hal>& hals,
+                    size_t instances) {
+    size_t missing = 0;
+    for (const Hal& hal : hals) {
+        for (size_t i = 0; i < instances; i++) {
+            sp<IBase> service = manager->get(hal.fqName, instanceName(i));
+            if (service.get() != static_cast<IBase*>(hal.service.get())) {
+                missing++;
+            }
+        }
+    }
+    return missing;
+}
+
+// Polls until every service is back; returns how many still aren't at the timeout.
+size_t waitForRecovery(const sp<ServiceManager>& manager, const std::vector<Hal>& hals,
+                       size_t instances) {
+    const steady_clock::time_point deadline = steady_clock::now() + kRecoveryTimeout;
+    size_t missing;
+    while ((missing = countMissing(manager, hals, instances)) > 0 &&
+           steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return missing;
+}
+
+// Like hwservicemanager's main(): serve calls first, then publish the epoch.
+sp<ServiceManager> startManager(FakeProperties* properties, ManagerSlot* slot) {
+    sp<ServiceManager> manager = new ServiceManager(std::make_unique<FakeAccessControl>());
+    slot->set(manager);
+    properties->set("hwservicemanager.ready", "true");
+    publishRestartEpoch(*properties);
+    return manager;
+}
+
+void usage(const char* name) {
+    std::cerr
+        << "usage: " << name << " [options]\n"
+        << "    --hals N        simulated HAL processes (default 100)\n"
+        << "    --instances I   instances each HAL adds (default 1)\n"
+        << "    --restarts R    times the manager is restarted (default 3)\n";
+}
+
+bool parseOptions(int argc, char** argv, Options* options) {
+    static const option kOptions[] = {
+        {"hals", required_argument, nullptr, 'n'},
+        {"instances", required_argument, nullptr, 'i'},
+        {"restarts", required_argument, nullptr, 'r'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+        bool ok = true;
+        switch (c) {
+            case 'n': ok = android::base::ParseUint(optarg, &options->hals); break;
+            case 'i': ok = android::base::ParseUint(optarg, &options->instances); break;
+            case 'r': ok = android::base::ParseUint(optarg, &options->restarts); break;
+            default: ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return optind == argc && options->hals > 0 && options->instances > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto properties = std::make_shared<FakeProperties>();
+    ManagerSlot slot;
+    startManager(properties.get(), &slot);
+
+    std::vector<Hal> hals(options.hals);
+    for (size_t i = 0; i < options.hals; i++) {
+        Hal& hal = hals[i];
+        hal.fqName = "vendor.drill.hal" + std::to_string(i) + "@1.0::IDrill";
+        hal.service = new FakeService({hal.fqName, "android.hidl.base@1.0::IBase"});
+        hal.keeper = std::make_unique<RegistrationKeeper>(
+                properties, [&slot] { return slot.get(); }, kWatchTimeout);
+        for (size_t instance = 0; instance < options.instances; instance++) {
+            if (!hal.keeper->add(instanceName(instance), hal.service)) {
+                std::cerr << "Failed to add " << hal.fqName << "/" << instanceName(instance)
+                          << "\n";
+                return 1;
+            }
+        }
+        hal.keeper->start();
+    }
+
+    std::cout << "hals=" << options.hals << " instances=" << options.instances
+              << " restarts=" << options.restarts << "\n\n";
+
+    bool recovered = true;
+    for (size_t restart = 1; restart <= options.restarts; restart++) {
+        // What init does for "onrestart setprop hwservicemanager.ready false".
+        slot.set(nullptr);
+        properties->set("hwservicemanager.ready", "false");
+
+        const steady_clock::time_point start = steady_clock::now();
+        sp<ServiceManager> manager = startManager(properties.get(), &slot);
+
+        const size_t missing = waitForRecovery(manager, hals, options.instances);
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                steady_clock::now() - start);
+
+        std::cout << "restart " << restart << ": recovery_ms=" << elapsed.count() / 1000.0
+                  << " missing=" << missing << "\n";
+        recovered = recovered && missing == 0;
+    }
+
+    return recovered ? 0 : 1;
+}